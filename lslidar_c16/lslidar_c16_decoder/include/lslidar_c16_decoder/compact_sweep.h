@@ -0,0 +1,121 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_COMPACT_SWEEP_H
+#define LSLIDAR_C16_COMPACT_SWEEP_H
+
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+
+#include <lslidar_c16_msgs/LslidarC16CompactSweep.h>
+#include <lslidar_c16_msgs/LslidarC16Sweep.h>
+
+namespace lslidar_c16_decoder {
+
+// Raw azimuth units of the compact sweep per rad.
+static const double COMPACT_AZIMUTH_SCALE = 36000.0 / (2.0*M_PI);
+
+/** @brief One point of a compact sweep, as handed to the visitor. */
+struct CompactPoint {
+    int ring;           ///< 0 is the lowest channel
+    double x;           ///< sensor frame, x forward, y left [m]
+    double y;
+    double z;
+    double azimuth;     ///< raw azimuth, without calibration [rad]
+    double distance;    ///< [m]
+    uint8_t intensity;
+    double time;        ///< since time_base [µs]
+};
+
+/** @brief Call visit(const CompactPoint&) for every point of a sweep.
+ *
+ *  Header only, so consumers only need lslidar_c16_msgs and this file.
+ *  The coordinates are computed the same way as in the decoder.
+ */
+template <typename Visitor>
+void visitCompactSweep(const lslidar_c16_msgs::LslidarC16CompactSweep& compact,
+                       Visitor& visit) {
+    CompactPoint point;
+    for (int ring = 0; ring < static_cast<int>(compact.scans.size()); ++ring) {
+        const lslidar_c16_msgs::LslidarC16CompactScan& scan = compact.scans[ring];
+        const double cos_altitude = cos(scan.altitude);
+        const double sin_altitude = sin(scan.altitude);
+        point.ring = ring;
+
+        for (size_t i = 0; i < scan.distance.size(); ++i) {
+            point.azimuth = scan.azimuth[i] / COMPACT_AZIMUTH_SCALE;
+            point.distance = scan.distance[i] * compact.distance_resolution;
+            const double xy = point.distance * cos_altitude;
+            const double azimuth = point.azimuth + scan.azimuth_offset;
+            point.x = xy * cos(azimuth);
+            point.y = -xy * sin(azimuth);
+            point.z = point.distance * sin_altitude;
+            point.intensity = scan.intensity[i];
+            point.time = scan.time_offset + scan.firing[i] * compact.firing_period;
+            visit(point);
+        }
+    }
+}
+
+namespace detail {
+
+struct SweepExpander {
+    lslidar_c16_msgs::LslidarC16Sweep& sweep;
+    size_t next;
+    int ring;
+
+    void operator()(const CompactPoint& p) {
+        if (p.ring != ring) {
+            ring = p.ring;
+            next = 0;
+        }
+        lslidar_c16_msgs::LslidarC16Point& point = sweep.scans[p.ring].points[next++];
+        point.time = p.time;
+        point.x = p.x;
+        point.y = p.y;
+        point.z = p.z;
+        point.azimuth = p.azimuth;
+        point.distance = p.distance;
+        point.intensity = p.intensity;
+    }
+};
+
+} // namespace detail
+
+/** @brief Expand a compact sweep back into an LslidarC16Sweep.
+ *
+ *  The point times are relative to time_base, which is also the stamp
+ *  of the expanded sweep.
+ */
+inline void expandCompactSweep(const lslidar_c16_msgs::LslidarC16CompactSweep& compact,
+                               lslidar_c16_msgs::LslidarC16Sweep& sweep) {
+    sweep.header = compact.header;
+    sweep.header.stamp = compact.time_base;
+    sweep.completeness = compact.completeness;
+    sweep.missing_packets = compact.missing_packets;
+    for (size_t ring = 0; ring < compact.scans.size(); ++ring) {
+        sweep.scans[ring].altitude = compact.scans[ring].altitude;
+        sweep.scans[ring].points.resize(compact.scans[ring].distance.size());
+    }
+    detail::SweepExpander expander = {sweep, 0, -1};
+    visitCompactSweep(compact, expander);
+}
+
+} // end namespace lslidar_c16_decoder
+
+#endif
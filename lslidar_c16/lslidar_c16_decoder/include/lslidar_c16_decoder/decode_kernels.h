@@ -0,0 +1,119 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_DECODE_KERNELS_H
+#define LSLIDAR_C16_DECODE_KERNELS_H
+
+#include <stdint.h>
+
+namespace lslidar_c16_decoder {
+
+// Layout of the raw packet as seen by the kernels, see RawPacket.
+static const int KERNEL_FIRINGS       = 24;
+static const int KERNEL_CHANNELS      = 16;
+static const int KERNEL_BLOCK_SIZE    = 100;
+static const int KERNEL_BLOCK_HEADER  = 4;
+static const int KERNEL_RETURN_SIZE   = 3;
+
+// The azimuth tables hold one entry per raw azimuth unit (0.01 deg)
+// over a full turn, plus a guard band on either side that absorbs the
+// per-channel calibration offsets and the interpolation past 2 pi.
+// Entry i is at (i - AZIMUTH_TABLE_GUARD) units.
+static const int AZIMUTH_TICKS = 36000;
+static const int AZIMUTH_TABLE_GUARD = 1800;
+static const int AZIMUTH_TABLE_SIZE = AZIMUTH_TICKS + 2*AZIMUTH_TABLE_GUARD;
+static const float AZIMUTH_TICKS_PER_RAD = 5729.5779513f;   // 36000 / 2 pi
+// Largest per-channel azimuth offset the guard band leaves room for.
+static const int MAX_AZIMUTH_OFFSET_TICKS = 1500;
+
+/** @brief Everything a kernel needs to decode one packet.
+ *
+ *  The per-firing azimuths are computed by the caller, the kernels
+ *  only do the per-return work.
+ */
+struct DecodeInput {
+    const uint8_t* packet;                      ///< raw 1206-byte packet
+    float firing_azimuth[KERNEL_FIRINGS];       ///< [rad] first channel
+    float azimuth_step[KERNEL_FIRINGS];         ///< [rad] between channels
+    const float* cos_azimuth;                   ///< AZIMUTH_TABLE_SIZE entries
+    const float* sin_azimuth;
+    const int32_t* azimuth_offset;              ///< KERNEL_CHANNELS table offsets
+    const float* cos_altitude;                  ///< KERNEL_CHANNELS entries
+    const float* sin_altitude;
+    float distance_resolution;                  ///< [m] per raw unit
+};
+
+/** @brief Decoded returns of one packet, indexed by [firing][channel].
+ *
+ *  x, y and z are already in the output frame (x forward, y left) and
+ *  include the calibration. azimuth is the uncorrected interpolated
+ *  azimuth of the return.
+ */
+struct DecodedFirings {
+    float azimuth[KERNEL_FIRINGS][KERNEL_CHANNELS];
+    float x[KERNEL_FIRINGS][KERNEL_CHANNELS];
+    float y[KERNEL_FIRINGS][KERNEL_CHANNELS];
+    float z[KERNEL_FIRINGS][KERNEL_CHANNELS];
+    uint16_t raw_distance[KERNEL_FIRINGS][KERNEL_CHANNELS];
+    uint8_t intensity[KERNEL_FIRINGS][KERNEL_CHANNELS];
+};
+
+typedef void (*DecodeKernel)(const DecodeInput& input, DecodedFirings& output);
+
+enum DecodeKernelType {
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    KERNEL_NEON
+};
+
+void decodeFiringsScalar(const DecodeInput& input, DecodedFirings& output);
+#ifdef LSLIDAR_C16_HAVE_AVX2
+void decodeFiringsAvx2(const DecodeInput& input, DecodedFirings& output);
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+void decodeFiringsNeon(const DecodeInput& input, DecodedFirings& output);
+#endif
+
+// Whether the kernel was built in and the running CPU can execute it.
+bool isDecodeKernelSupported(DecodeKernelType type);
+
+// The fastest kernel supported by the running CPU.
+DecodeKernelType bestDecodeKernel();
+
+// NULL if the kernel is not supported.
+DecodeKernel getDecodeKernel(DecodeKernelType type);
+
+const char* decodeKernelName(DecodeKernelType type);
+
+// Fill the cos and sin azimuth tables, AZIMUTH_TABLE_SIZE entries each.
+void fillAzimuthTables(float* cos_azimuth, float* sin_azimuth);
+
+// The azimuth_offset entry of a channel corrected by offset [rad].
+int32_t azimuthTableOffset(double offset);
+
+// Index into the azimuth tables, rounded to the closest raw unit.
+// offset is the azimuth_offset entry of the channel.
+inline int azimuthTableIndex(float azimuth, int32_t offset) {
+    int idx = static_cast<int>(azimuth * AZIMUTH_TICKS_PER_RAD + 0.5f) + offset;
+    if (idx < 0) idx = 0;
+    if (idx > AZIMUTH_TABLE_SIZE - 1) idx = AZIMUTH_TABLE_SIZE - 1;
+    return idx;
+}
+
+} // end namespace lslidar_c16_decoder
+
+#endif
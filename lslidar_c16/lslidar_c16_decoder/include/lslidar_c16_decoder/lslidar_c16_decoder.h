@@ -21,25 +21,42 @@
 #define DEG_TO_RAD 0.017453292
 #define RAD_TO_DEG 57.29577951
 
+#include <atomic>
 #include <cmath>
+#include <cstddef>
 #include <vector>
 #include <string>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
 
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <sensor_msgs/LaserScan.h>
+#include <sensor_msgs/Image.h>
 #include <std_msgs/Int8.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl_ros/point_cloud.h>
 #include <pcl/point_types.h>
+#include <tf/transform_listener.h>
+#include <diagnostic_updater/diagnostic_updater.h>
 
+#include <lslidar_c16_msgs/LslidarC16CompactSweep.h>
 #include <lslidar_c16_msgs/LslidarC16Packet.h>
 #include <lslidar_c16_msgs/LslidarC16Point.h>
 #include <lslidar_c16_msgs/LslidarC16Scan.h>
 #include <lslidar_c16_msgs/LslidarC16Sweep.h>
 #include <lslidar_c16_msgs/LslidarC16Layer.h>
 
+#include <lslidar_c16_driver/message_pool.h>
+#include <lslidar_c16_driver/packet_format.h>
+#include <lslidar_c16_driver/statistics.h>
+
+#include <lslidar_c16_decoder/decode_kernels.h>
+#include <lslidar_c16_decoder/roi_mask.h>
+#include <lslidar_c16_decoder/sweep_buffer.h>
+#include <lslidar_c16_decoder/voxel_filter.h>
+
 
 namespace lslidar_c16_decoder {
 
@@ -68,7 +85,7 @@ static const double  BLOCK_TDURATION   = 110.592; // [µs]
 static const double  DSR_TOFFSET       = 1;   
 static const double  FIRING_TOFFSET    = 16;  
 
-static const int PACKET_SIZE        = 1206;
+static const int PACKET_SIZE        = lslidar_c16_driver::MAX_PACKET_SIZE;
 static const int BLOCKS_PER_PACKET  = 12;
 static const int PACKET_STATUS_SIZE = 4;
 static const int SCANS_PER_PACKET =
@@ -76,6 +93,41 @@ static const int SCANS_PER_PACKET =
 static const int FIRINGS_PER_PACKET =
         FIRINGS_PER_BLOCK * BLOCKS_PER_PACKET;
 
+/** @brief Packet layouts, one per return mode.
+ *
+ *  A packet always holds 12 blocks of two firings, each starting with
+ *  the 2-byte BLOCK_HEADER. FIRINGS is the number of firings it covers
+ *  in time, and firing() gives the block firing holding a return of
+ *  the firing fir_idx. PAIRED_BLOCKS tells whether blocks 2k and 2k+1
+ *  repeat the same azimuth. The decoder is instantiated once per
+ *  layout.
+ */
+struct SingleReturnFormat {
+    static const uint16_t BLOCK_HEADER = UPPER_BANK;
+    static const bool PAIRED_BLOCKS = false;
+    static const int RETURNS = 1;
+    static const int FIRINGS = FIRINGS_PER_PACKET;
+    static const char* name() { return "single return"; }
+    static int firing(int fir_idx, int) { return fir_idx; }
+};
+
+// Blocks 2k and 2k+1 hold the first and second return of the same
+// two firings, with the same azimuth.
+struct DualReturnFormat {
+    static const uint16_t BLOCK_HEADER = UPPER_BANK;
+    static const bool PAIRED_BLOCKS = true;
+    static const int RETURNS = 2;
+    static const int FIRINGS = FIRINGS_PER_PACKET / 2;
+    static const char* name() { return "dual return"; }
+    static int firing(int fir_idx, int ret) {
+        return ((fir_idx/2)*RETURNS + ret)*FIRINGS_PER_BLOCK + fir_idx%2;
+    }
+};
+
+// Capacity of each ring in the sweep buffer. The C16 fires 20000
+// times per second, i.e. 4000 firings per ring at 5 Hz.
+static const size_t MAX_POINTS_PER_RING = 8192;
+
 // Pre-compute the sine and cosine for the altitude angles.
 static const double scan_altitude[16] = {
     -0.2617993877991494,   0.017453292519943295,
@@ -110,15 +162,44 @@ static const double sin_scan_altitude[16] = {
     std::sin(scan_altitude[14]), std::sin(scan_altitude[15]),
 };
 
+// Layout of the points written into the PointCloud2 messages:
+// float32 x, y, z, intensity.
+static const uint32_t CLOUD_POINT_STEP = 16;
+// float32 x, y, z, intensity, time.
+static const uint32_t SECTOR_POINT_STEP = 20;
+// float32 x, y, z, intensity, uint16 ring, 2 bytes padding, float32 time.
+static const uint32_t RING_TIME_POINT_STEP = 24;
+// float32 x, y, z, intensity, uint16 ring, uint16 lidar, float32 time.
+static const uint32_t MERGED_POINT_STEP = 24;
+
+// The CLOUD_XYZIRT point of lslidar_point_cloud as it is written
+// into the message. PointXYZIRT below is the PCL type to read it into.
+struct PackedPointXYZIRT {
+    float x;
+    float y;
+    float z;
+    float intensity;
+    uint16_t ring;
+    uint16_t padding;
+    float time;
+};
+static_assert(sizeof(PackedPointXYZIRT) == RING_TIME_POINT_STEP,
+              "PackedPointXYZIRT must match RING_TIME_POINT_STEP");
+static_assert(offsetof(PackedPointXYZIRT, intensity) + sizeof(float) == CLOUD_POINT_STEP,
+              "the XYZI layout must be the head of the XYZIRT layout");
+
 typedef struct{
     double distance;
     double intensity;
 }point_struct;
 
-struct PointXYZIT {
+// Point with the remapped ring index (0 is the lowest channel) and
+// the time of the point relative to the cloud stamp [s].
+struct PointXYZIRT {
   PCL_ADD_POINT4D
-  uint8_t intensity;
-  double timestamp;
+  float intensity;
+  uint16_t ring;
+  float time;
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW  // make sure our new allocators are aligned
 } EIGEN_ALIGN16;
 // enforce SSE padding for correct memory alignment
@@ -129,20 +210,55 @@ public:
     LslidarC16Decoder(ros::NodeHandle& n, ros::NodeHandle& pn);
     LslidarC16Decoder(const LslidarC16Decoder&) = delete;
     LslidarC16Decoder operator=(const LslidarC16Decoder&) = delete;
-    ~LslidarC16Decoder() {return;}
+    ~LslidarC16Decoder();
 
-    bool initialize();
+    // How packets reach the decoder.
+    enum PacketSource {
+        PACKET_TOPIC,       ///< subscribe to lslidar_packet
+        DIRECT_PACKETS,     ///< the owner calls processPacket()
+        OFFLINE             ///< like DIRECT_PACKETS, but nothing is published
+    };
+
+    bool initialize(PacketSource source = PACKET_TOPIC);
+
+    // Decode one raw 1206-byte packet and publish the sweep it completes.
+    void processPacket(const uint8_t* data, const ros::Time& stamp) {
+        const uint64_t start = lslidar_c16_driver::monotonicNs();
+        (this->*packet_handler)(data, stamp);
+        packet_time.add(lslidar_c16_driver::monotonicNs() - start);
+    }
+
+    // Number of completed sweeps and of the points they held.
+    uint64_t getSweepCount() const { return sweep_count; }
+    uint64_t getPointCount() const { return point_count; }
+
+    // Called with every completed sweep and the time its point times
+    // are relative to, while merged_pub has subscribers.
+    typedef boost::function<void(const LslidarC16Decoder&, const ros::Time&)> MergeCallback;
+    void setMergeCallback(const MergeCallback& callback, const ros::Publisher& merged_pub) {
+        merge_callback = callback;
+        merge_pub = merged_pub;
+    }
+
+    // Append the points of the completed sweep to a cloud set up with
+    // CLOUD_MERGED, moved by the 3x4 row-major transform. time_offset
+    // is added to the point times [s].
+    size_t appendMergedPoints(sensor_msgs::PointCloud2& cloud, const float* transform,
+                              float time_offset, uint16_t lidar) const;
+
+    enum CloudLayout {
+        CLOUD_XYZI,         ///< CLOUD_POINT_STEP
+        CLOUD_XYZIT,        ///< SECTOR_POINT_STEP
+        CLOUD_XYZIRT,       ///< RING_TIME_POINT_STEP
+        CLOUD_MERGED        ///< MERGED_POINT_STEP
+    };
+    static void initPointCloudFields(sensor_msgs::PointCloud2& cloud, CloudLayout layout);
 
     typedef boost::shared_ptr<LslidarC16Decoder> LslidarC16DecoderPtr;
     typedef boost::shared_ptr<const LslidarC16Decoder> LslidarC16DecoderConstPtr;
 
 private:
 
-    union TwoBytes {
-        uint16_t distance;
-        uint8_t  bytes[2];
-    };
-
     struct RawBlock {
         uint16_t header;        ///< UPPER_BANK or LOWER_BANK
         uint16_t rotation;      ///< 0-35999, divide by 100 to get degrees
@@ -155,33 +271,75 @@ private:
         uint8_t factory[2];
     };
 
+    // LaserScan bins of one ring, filled while the sweep is decoded.
+    struct ScanBins {
+        std::vector<float> ranges;
+        std::vector<float> intensities;
+        size_t points;
+    };
+
     struct Firing {
         // Azimuth associated with the first shot within this firing.
+        // The per-return values are in decoded_firings.
         double firing_azimuth;
-        double azimuth[SCANS_PER_FIRING];
-        double distance[SCANS_PER_FIRING];
-        double intensity[SCANS_PER_FIRING];
     };
 
     // Intialization sequence
     bool loadParameters();
-    bool createRosIO();
-
+    bool loadCalibration();
+    bool loadRoi();
+    bool createRosIO(PacketSource source);
+    void diagnosticTimer(const ros::WallTimerEvent& event);
+    void statisticsDiagnostics(diagnostic_updater::DiagnosticStatusWrapper& stat);
 
     // Callback function for a single lslidar packet.
+    template <typename Format>
     bool checkPacketValidity(const RawPacket* packet);
+    static bool pairedBlocks(const RawPacket* packet);
+    template <typename Format>
     void decodePacket(const RawPacket* packet);
     void layerCallback(const std_msgs::Int8Ptr& msg);
     void packetCallback(const lslidar_c16_msgs::LslidarC16PacketConstPtr& msg);
+    template <typename Format>
+    void storeFirings(size_t start_fir_idx, size_t end_fir_idx);
+
+    // processPacket() goes through packet_handler, which is set once
+    // for the return mode. With return_mode auto, detectFormat() picks
+    // it from the first DETECT_PACKETS valid packets, and picks it
+    // again once as many packets in a row do not fit the layout.
+    typedef void (LslidarC16Decoder::*PacketHandler)(const uint8_t*, const ros::Time&);
+    template <typename Format>
+    void processFormat(const uint8_t* data, const ros::Time& stamp);
+    template <typename Format>
+    void checkContinuity(const ros::Time& stamp);
+    void startSweep(const ros::Time& stamp);
+    void finishSweep();
+    void publishOutputs();
+    void outputLoop();
+    void detectFormat(const uint8_t* data, const ros::Time& stamp);
     // Publish data
+    void publishSweep();
+    void publishCompactSweep();
+    void selectCloudPoints();
     void publishPointCloud();
-    void publishChannelScan();
+    void publishOrganized();
+    // Whether point j of ring i goes into the point cloud outputs.
+    bool inCloud(const SweepBuffer& buffer, int ring, size_t j) const;
+    // lslidar_point_cloud message sized for num_points points.
+    sensor_msgs::PointCloud2Ptr allocatePointCloud(const ros::Time& stamp, size_t num_points);
+    bool sweepTimeSpan(float& first_time, float& last_time);
+    ros::Time sweepTimeBase(float last_time);
+    void publishSector();
+    bool deskewSweep(ros::Time& target_time);
+    void publishChannelScan(bool publish_layer);
     // Publish scan Data
     void publishScan();
+    void resetScanBins(ScanBins& bins);
+    void publishIncrementalScan();
 
-    // Check if a point is in the required range.
-    bool isPointInRange(const double& distance) {
-        return (distance >= min_range && distance <= max_range);
+    // Whether an output has to be built.
+    bool wanted(const ros::Publisher& pub) const {
+        return offline || pub.getNumSubscribers() > 0;
     }
 
     double rawAzimuthToDouble(const uint16_t& raw_azimuth) {
@@ -206,33 +364,175 @@ private:
     double angle3_disable_max;
     double frequency;
     bool publish_point_cloud;
+    bool point_cloud_ring_time;
+    enum DownsampleMode {
+        DOWNSAMPLE_NONE,
+        DOWNSAMPLE_VOXEL,   ///< first point of every voxel_size voxel
+        DOWNSAMPLE_RING     ///< every ring_decimation-th point of a ring
+    };
+    DownsampleMode downsample;
+    double voxel_size;
+    int ring_decimation;
+    bool organized_cloud;
+    bool range_image;
+    int range_image_width;
     bool use_gps_ts;
     bool publish_scan;
+    bool incremental_scan;
+    int sectors;
     bool apollo_interface;
-    double cos_azimuth_table[6300];
-    double sin_azimuth_table[6300];
+    std::string simd;
+    std::string return_mode;
+    PacketHandler packet_handler;
+    bool auto_format;
+    int detect_packets;             ///< valid packets seen by detectFormat()
+    int detect_paired;              ///< of these, with paired blocks
+    int format_mismatches;          ///< packets in a row not fitting the layout
+    // Calibration, indexed by the channel within a firing. altitude
+    // defaults to scan_altitude, azimuth_offset to zero [rad].
+    double altitude[SCANS_PER_FIRING];
+    double azimuth_offset[SCANS_PER_FIRING];
+    std::vector<float> cos_azimuth_table;   ///< AZIMUTH_TABLE_SIZE entries
+    std::vector<float> sin_azimuth_table;
+    int32_t azimuth_offset_table[SCANS_PER_FIRING];
+
+    // Returns dropped before they are stored, see loadRoi().
+    RoiMask roi_mask;
+    // Stored returns left out of the point cloud outputs, the sector
+    // set by angle3_disable_min and angle3_disable_max.
+    RoiMask cloud_mask;
+    float cos_altitude_table[SCANS_PER_FIRING];
+    float sin_altitude_table[SCANS_PER_FIRING];
 
     bool is_first_sweep;
     double last_azimuth;
+    ros::Time last_packet_stamp;
+    // Azimuth not covered by packets in the current sweep and in the
+    // next one, which starts past a gap across the wrap [rad].
+    double sweep_gap;
+    double next_sweep_gap;
+    uint32_t sweep_missing_packets;
+    uint32_t next_sweep_missing_packets;
+    double sweep_completeness;      ///< of the completed sweep
+    double min_sweep_completeness;
     double sweep_start_time;
+    ros::Time sweep_stamp;
+    ros::Time cloud_stamp;
     double packet_start_time;
-    int layer_num;
+    // Set by layerCallback() on the callback thread, read on the
+    // thread that decodes the packets, which in the fused nodelet is
+    // the device thread.
+    std::atomic<int> layer_num;
+    uint64_t sweep_count;
+    uint64_t point_count;
+    double last_sweep_start_time;
     Firing firings[FIRINGS_PER_PACKET];
 
+    // Per-return decoding, scalar or SIMD depending on the CPU.
+    DecodeKernel decode_kernel;
+    DecodeInput decode_input;
+    DecodedFirings decoded_firings;
+
     // ROS related parameters
+    bool offline;
     ros::NodeHandle nh;
     ros::NodeHandle pnh;
 
+    // Hot path counters, reported in the diagnostics and on
+    // lslidar_decoder_statistics. They are written by the decoding
+    // thread, sweep_time by the output thread with two_stage.
+    double statistics_period;
+    lslidar_c16_driver::Statistics statistics;
+    lslidar_c16_driver::Statistics::Snapshot diag_statistics;
+    lslidar_c16_driver::StatisticsPublisher statistics_pub;
+    lslidar_c16_driver::Counter& invalid_packets;
+    lslidar_c16_driver::Counter& missing_packets;
+    lslidar_c16_driver::Counter& missing_degrees;
+    lslidar_c16_driver::Counter& skipped_sweeps;
+    lslidar_c16_driver::Counter& output_overruns;
+    lslidar_c16_driver::Histogram& packet_time;     ///< processPacket() [ns]
+    lslidar_c16_driver::Histogram& sweep_time;      ///< sweep outputs [us]
+    lslidar_c16_driver::Histogram& sweep_points;
+    lslidar_c16_driver::Histogram& sweep_period;    ///< [us]
+    lslidar_c16_driver::Histogram& sweep_jitter;    ///< distance to 1/frequency [us]
+    lslidar_c16_driver::Histogram& sweep_coverage;  ///< completeness [%]
+    uint64_t diag_invalid_packets;
+    uint64_t diag_missing_packets;
+    boost::shared_ptr<diagnostic_updater::Updater> diagnostics;
+    ros::WallTimer diagnostic_timer;
+
     //std::string fixed_frame_id;
     std::string frame_id;
 
-    lslidar_c16_msgs::LslidarC16SweepPtr sweep_data;
-    lslidar_c16_msgs::LslidarC16LayerPtr multi_scan;
+    // Bins of the scan published for layer_num, used with
+    // incremental_scan. The layer is only switched between sweeps.
+    int scan_bin_layer;
+    bool scan_bins_active;
+    float scan_bin_scale;
+    std::vector<uint8_t> scan_bin_disabled;
+    ScanBins layer_bins;
+
+    // Sector streaming. sector_begin holds the ring sizes at the start
+    // of the current sector.
+    int current_sector;
+    double sector_scale;
+    size_t sector_begin[SWEEP_RINGS];
+    ros::Publisher sector_pub;
+    ros::Publisher organized_cloud_pub;
+    ros::Publisher range_image_pub;
+    ros::Publisher intensity_image_pub;
+
+    // De-skew of the point cloud, see deskewSweep().
+    bool deskew;
+    std::string deskew_fixed_frame;
+    int deskew_slices;
+    double deskew_timeout;
+    boost::shared_ptr<tf::TransformListener> tf_listener;
+    std::vector<float> deskew_transforms;   ///< 3x4 row-major per slice
+
+    // Merging with other lidars, see setMergeCallback().
+    MergeCallback merge_callback;
+    ros::Publisher merge_pub;
+
+    // Points of the sweep being assembled. The LslidarC16Sweep
+    // message is only built from it when lslidar_sweep is subscribed.
+    SweepBuffer sweep_buffer;
+
+    // With two_stage, the packets are decoded into pipeline_buffer.
+    // A completed sweep is swapped into sweep_buffer, where the output
+    // thread builds its outputs while the next one is decoded. The
+    // outputs only read sweep_buffer and the state below, which the
+    // decoding thread sets when it hands a sweep over.
+    bool two_stage;
+    SweepBuffer pipeline_buffer;
+    SweepBuffer* decode_buffer;     ///< sweep_buffer or pipeline_buffer
+    ScanBins output_bins;           ///< layer_bins of the completed sweep
+    int scan_layer;                 ///< layer_num when the sweep completed
+    uint32_t completed_missing_packets;
+    boost::shared_ptr<boost::thread> output_thread;
+    boost::mutex output_mutex;
+    boost::condition_variable output_cond;
+    bool output_pending;            ///< output_mutex held
+    bool output_running;            ///< output_mutex held
+
+    // Sweep buffer indices of the points in lslidar_point_cloud, in
+    // ring order, see selectCloudPoints().
+    std::vector<uint32_t> cloud_points;
+    VoxelFilter voxel_filter;
+
+    // Published messages are recycled once no subscriber holds them.
+    int message_pool_size;
+    lslidar_c16_driver::MessagePool<lslidar_c16_msgs::LslidarC16Sweep> sweep_pool;
+    lslidar_c16_driver::MessagePool<lslidar_c16_msgs::LslidarC16CompactSweep> compact_sweep_pool;
+    lslidar_c16_driver::MessagePool<lslidar_c16_msgs::LslidarC16Layer> layer_pool;
+    lslidar_c16_driver::MessagePool<sensor_msgs::LaserScan> scan_pool;
+    lslidar_c16_driver::MessagePool<sensor_msgs::PointCloud2> cloud_pool;
     sensor_msgs::PointCloud2 point_cloud_data;
 
     ros::Subscriber packet_sub;
     ros::Subscriber layer_sub;
     ros::Publisher sweep_pub;
+    ros::Publisher compact_sweep_pub;
     ros::Publisher point_cloud_pub;
     ros::Publisher scan_pub;
     ros::Publisher channel_scan_pub;
@@ -241,14 +541,14 @@ private:
 
 typedef LslidarC16Decoder::LslidarC16DecoderPtr LslidarC16DecoderPtr;
 typedef LslidarC16Decoder::LslidarC16DecoderConstPtr LslidarC16DecoderConstPtr;
-typedef PointXYZIT VPoint;
+typedef PointXYZIRT VPoint;
 typedef pcl::PointCloud<VPoint> VPointCloud;
 
 } // end namespace lslidar_c16_decoder
 
 
-POINT_CLOUD_REGISTER_POINT_STRUCT(lslidar_c16_decoder::PointXYZIT,
+POINT_CLOUD_REGISTER_POINT_STRUCT(lslidar_c16_decoder::PointXYZIRT,
                                   (float, x, x)(float, y, y)(float, z, z)(
-                                      uint8_t, intensity,
-                                      intensity)(double, timestamp, timestamp))
+                                      float, intensity, intensity)(
+                                      uint16_t, ring, ring)(float, time, time))
 #endif
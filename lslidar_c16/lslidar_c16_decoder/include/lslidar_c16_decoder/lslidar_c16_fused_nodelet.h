@@ -0,0 +1,61 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_FUSED_NODELET_H
+#define LSLIDAR_C16_FUSED_NODELET_H
+
+#include <boost/thread.hpp>
+
+#include <ros/ros.h>
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include <lslidar_c16_driver/lslidar_c16_driver.h>
+#include <lslidar_c16_decoder/lslidar_c16_decoder.h>
+
+namespace lslidar_c16_decoder {
+
+/** @brief Driver and decoder in one nodelet.
+ *
+ *  Packets are decoded straight from the driver's receive buffer, so
+ *  no LslidarC16Packet message is created on the way to the sweep.
+ *  With ~publish_packets the raw packets are also published on
+ *  lslidar_packet, e.g. for recording.
+ */
+class LslidarC16FusedNodelet: public nodelet::Nodelet {
+public:
+
+  LslidarC16FusedNodelet();
+  ~LslidarC16FusedNodelet();
+
+private:
+
+  virtual void onInit();
+  void devicePoll();
+
+  volatile bool running;
+  bool publish_packets;
+  boost::shared_ptr<boost::thread> device_thread;
+
+  lslidar_c16_driver::LslidarC16DriverPtr driver;
+  LslidarC16DecoderPtr decoder;
+};
+
+} // end namespace lslidar_c16_decoder
+
+
+#endif
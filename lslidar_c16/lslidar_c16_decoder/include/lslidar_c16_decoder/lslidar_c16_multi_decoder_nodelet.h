@@ -0,0 +1,99 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_MULTI_DECODER_NODELET_H
+#define LSLIDAR_C16_MULTI_DECODER_NODELET_H
+
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+#include <ros/ros.h>
+#include <ros/callback_queue.h>
+#include <pluginlib/class_list_macros.h>
+#include <nodelet/nodelet.h>
+
+#include <lslidar_c16_decoder/lslidar_c16_decoder.h>
+
+namespace lslidar_c16_decoder {
+
+/** @brief Decodes several C16 units on a shared worker pool.
+ *
+ *  The names in the ~lidars list select one parameter namespace per
+ *  sensor (~<name>/frame_id, ~<name>/min_range, ...), in the same way
+ *  as the multi driver. Each sensor gets its own decoder subscribed to
+ *  <name>/lslidar_packet and publishing under <name>/.
+ *
+ *  The packets of a sensor land in its own callback queue. ~threads
+ *  workers drain the queues, starting with their own sensors and
+ *  stealing from the others when those are idle. A sensor is only
+ *  ever decoded by one worker at a time, so its packets are handled
+ *  in order.
+ *
+ *  With ~merged_cloud the sweeps of all sensors are also written into
+ *  one lslidar_point_cloud_merged in ~merged_frame_id, each moved by
+ *  the static ~<name>/extrinsics of its sensor. Sweeps whose start
+ *  times are within ~merge_max_offset end up in the same cloud.
+ */
+class LslidarC16MultiDecoderNodelet: public nodelet::Nodelet {
+public:
+
+  LslidarC16MultiDecoderNodelet();
+  ~LslidarC16MultiDecoderNodelet();
+
+private:
+
+  struct Sensor {
+    std::string name;
+    uint16_t index;
+    float extrinsics[12];   ///< 3x4 row-major, sensor to merged frame
+    bool merged;            ///< part of the pending merged cloud
+    boost::mutex mutex;
+    ros::CallbackQueue queue;
+    // Declared after the queue, so its subscriptions go first.
+    LslidarC16DecoderPtr decoder;
+  };
+  typedef boost::shared_ptr<Sensor> SensorPtr;
+
+  virtual void onInit();
+  void worker(size_t index);
+  bool loadExtrinsics(ros::NodeHandle& lidar_pnh, Sensor& sensor);
+  void mergeSweep(Sensor& sensor, const LslidarC16Decoder& decoder,
+                  const ros::Time& time_base);
+  void publishMerged();
+
+  volatile bool running;
+  std::vector<SensorPtr> sensors;
+  boost::thread_group workers;
+
+  // Merged cloud, guarded by merge_mutex.
+  bool merged_cloud;
+  std::string merged_frame_id;
+  double merge_max_offset;
+  boost::mutex merge_mutex;
+  ros::Publisher merged_pub;
+  lslidar_c16_driver::MessagePool<sensor_msgs::PointCloud2> merged_pool;
+  sensor_msgs::PointCloud2Ptr pending_cloud;
+  ros::Time pending_base;
+  size_t pending_sweeps;
+};
+
+} // end namespace lslidar_c16_decoder
+
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_ROI_MASK_H
+#define LSLIDAR_C16_ROI_MASK_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include <lslidar_c16_decoder/decode_kernels.h>
+#include <lslidar_c16_decoder/sweep_buffer.h>
+
+namespace lslidar_c16_decoder {
+
+/** @brief Which returns are kept, by ring, raw azimuth and raw range.
+ *
+ *  Every ring has one bit per raw azimuth unit (0.01 deg) in the
+ *  sensor's clockwise azimuth, set for excluded directions, and its
+ *  own raw distance limits. The bits take 72 KB in total and stay in
+ *  cache while a packet is stored.
+ */
+struct RoiMask {
+
+    static const int WORDS_PER_RING = (AZIMUTH_TICKS + 63) / 64;
+
+    RoiMask(): sectors(false) {
+        words.assign(SWEEP_RINGS * WORDS_PER_RING, 0);
+        for (int r = 0; r < SWEEP_RINGS; ++r) {
+            min_distance[r] = 0;
+            max_distance[r] = 0xffff;
+        }
+    }
+
+    /// Exclude count ticks from begin on, wrapping through 0, in the
+    /// rings first_ring to last_ring.
+    void excludeSector(int first_ring, int last_ring, int begin, int count) {
+        for (int r = first_ring; r <= last_ring; ++r) {
+            for (int i = 0, t = begin; i < count && i < AZIMUTH_TICKS; ++i) {
+                words[r * WORDS_PER_RING + t / 64] |= uint64_t(1) << (t % 64);
+                t = t + 1 < AZIMUTH_TICKS ? t + 1 : 0;
+            }
+        }
+        sectors = true;
+    }
+
+    void setRange(int ring, uint16_t min_raw, uint16_t max_raw) {
+        min_distance[ring] = min_raw;
+        max_distance[ring] = max_raw;
+    }
+
+    /// tick is the raw azimuth, 0 to AZIMUTH_TICKS - 1.
+    bool contains(int ring, uint16_t raw_distance, int tick) const {
+        if (raw_distance < min_distance[ring] || raw_distance > max_distance[ring])
+            return false;
+        return !sectors ||
+                !(words[ring * WORDS_PER_RING + tick / 64] >> (tick % 64) & 1);
+    }
+
+    bool sectors;                       ///< any direction excluded
+    uint16_t min_distance[SWEEP_RINGS]; ///< raw units, inclusive
+    uint16_t max_distance[SWEEP_RINGS];
+    std::vector<uint64_t> words;
+};
+
+} // end namespace lslidar_c16_decoder
+
+#endif
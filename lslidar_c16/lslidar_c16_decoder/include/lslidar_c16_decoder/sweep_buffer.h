@@ -0,0 +1,110 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_SWEEP_BUFFER_H
+#define LSLIDAR_C16_SWEEP_BUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace lslidar_c16_decoder {
+
+static const int SWEEP_RINGS = 16;
+
+/** @brief Points of one sweep in structure-of-arrays form.
+ *
+ *  Every ring owns a fixed slice of `capacity` entries in each array,
+ *  ring r starting at r*capacity. The arrays are allocated once and
+ *  reused for every sweep; clear() only resets the ring sizes.
+ */
+struct SweepBuffer {
+
+    SweepBuffer(): capacity(0), dropped(0) {
+        clear();
+    }
+
+    void allocate(size_t capacity_per_ring) {
+        capacity = capacity_per_ring;
+        const size_t n = capacity * SWEEP_RINGS;
+        x.assign(n, 0.0f);
+        y.assign(n, 0.0f);
+        z.assign(n, 0.0f);
+        azimuth.assign(n, 0.0f);
+        time.assign(n, 0.0f);
+        distance.assign(n, 0);
+        intensity.assign(n, 0);
+        clear();
+    }
+
+    // Exchange the points with other, without copying them.
+    void swap(SweepBuffer& other) {
+        std::swap(capacity, other.capacity);
+        std::swap(dropped, other.dropped);
+        for (int r = 0; r < SWEEP_RINGS; ++r)
+            std::swap(size[r], other.size[r]);
+        x.swap(other.x);
+        y.swap(other.y);
+        z.swap(other.z);
+        azimuth.swap(other.azimuth);
+        time.swap(other.time);
+        distance.swap(other.distance);
+        intensity.swap(other.intensity);
+    }
+
+    void clear() {
+        for (int r = 0; r < SWEEP_RINGS; ++r)
+            size[r] = 0;
+        dropped = 0;
+    }
+
+    /// Index of the next free slot of a ring, or -1 if the ring is full.
+    long reserve(int ring) {
+        if (size[ring] == capacity) {
+            ++dropped;
+            return -1;
+        }
+        return ring * capacity + size[ring]++;
+    }
+
+    size_t begin(int ring) const { return ring * capacity; }
+    size_t end(int ring) const { return ring * capacity + size[ring]; }
+
+    size_t totalSize() const {
+        size_t total = 0;
+        for (int r = 0; r < SWEEP_RINGS; ++r)
+            total += size[r];
+        return total;
+    }
+
+    size_t capacity;            ///< points per ring
+    size_t size[SWEEP_RINGS];   ///< points stored per ring
+    size_t dropped;             ///< points lost to a full ring
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> azimuth;     ///< [rad]
+    std::vector<float> time;        ///< [µs] since the sweep start
+    std::vector<uint16_t> distance; ///< raw units of DISTANCE_RESOLUTION
+    std::vector<uint8_t> intensity;
+};
+
+} // end namespace lslidar_c16_decoder
+
+#endif
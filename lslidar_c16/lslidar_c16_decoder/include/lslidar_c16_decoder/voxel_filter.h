@@ -0,0 +1,93 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_VOXEL_FILTER_H
+#define LSLIDAR_C16_VOXEL_FILTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace lslidar_c16_decoder {
+
+/** @brief Hashed voxel grid keeping the first point of every voxel.
+ *
+ *  The table is an open-addressing hash set sized once for the most
+ *  points a sweep can hold. clear() starts a new generation instead
+ *  of wiping the table, so a sweep costs one probe per point.
+ */
+struct VoxelFilter {
+
+    VoxelFilter(): scale(1.0f), shift(64), generation(0) {}
+
+    void allocate(size_t max_points, float voxel_size) {
+        size_t slots = 1;
+        int bits = 0;
+        while (slots < 2 * max_points) {
+            slots <<= 1;
+            ++bits;
+        }
+        keys.assign(slots, 0);
+        stamps.assign(slots, 0);
+        scale = 1.0f / voxel_size;
+        shift = 64 - bits;
+        generation = 0;
+        clear();
+    }
+
+    void clear() {
+        if (++generation == 0) {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            generation = 1;
+        }
+    }
+
+    /// True if the point is the first one of its voxel.
+    bool insert(float x, float y, float z) {
+        const uint64_t key = voxelKey(x) << 42 | voxelKey(y) << 21 | voxelKey(z);
+        const size_t mask = keys.size() - 1;
+        size_t slot = (key * 0x9e3779b97f4a7c15ull) >> shift;
+        while (stamps[slot] == generation) {
+            if (keys[slot] == key)
+                return false;
+            slot = (slot + 1) & mask;
+        }
+        stamps[slot] = generation;
+        keys[slot] = key;
+        return true;
+    }
+
+private:
+
+    // 21 bits per axis, enough for +-1e6 voxels.
+    uint64_t voxelKey(float v) const {
+        return static_cast<uint64_t>(
+                    static_cast<int64_t>(std::floor(v * scale))) & 0x1fffff;
+    }
+
+    float scale;                    ///< 1 / voxel size
+    int shift;                      ///< 64 - log2(slots)
+    uint32_t generation;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> stamps;   ///< slot used if equal to generation
+};
+
+} // end namespace lslidar_c16_decoder
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstddef>
+
+#include <lslidar_c16_decoder/decode_kernels.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace lslidar_c16_decoder {
+
+static inline const uint8_t* firingData(const uint8_t* packet, int fir_idx) {
+    return packet + (fir_idx/2)*KERNEL_BLOCK_SIZE + KERNEL_BLOCK_HEADER +
+            (fir_idx%2)*KERNEL_CHANNELS*KERNEL_RETURN_SIZE;
+}
+
+void decodeFiringsScalar(const DecodeInput& input, DecodedFirings& output) {
+    for (int fir_idx = 0; fir_idx < KERNEL_FIRINGS; ++fir_idx) {
+        const uint8_t* data = firingData(input.packet, fir_idx);
+
+        for (int ch = 0; ch < KERNEL_CHANNELS; ++ch) {
+            const uint8_t* ret = data + ch*KERNEL_RETURN_SIZE;
+
+            // The distance is little-endian.
+            const uint16_t raw_distance = ret[0] | (ret[1] << 8);
+            const float azimuth = input.firing_azimuth[fir_idx] +
+                    ch * input.azimuth_step[fir_idx];
+            const int table_idx = azimuthTableIndex(azimuth, input.azimuth_offset[ch]);
+
+            const float distance = raw_distance * input.distance_resolution;
+            const float xy = distance * input.cos_altitude[ch];
+
+            output.azimuth[fir_idx][ch] = azimuth;
+            output.x[fir_idx][ch] = xy * input.cos_azimuth[table_idx];
+            output.y[fir_idx][ch] = -(xy * input.sin_azimuth[table_idx]);
+            output.z[fir_idx][ch] = distance * input.sin_altitude[ch];
+            output.raw_distance[fir_idx][ch] = raw_distance;
+            output.intensity[fir_idx][ch] = ret[2];
+        }
+    }
+    return;
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+void decodeFiringsNeon(const DecodeInput& input, DecodedFirings& output) {
+    const float32x4_t kticks = vdupq_n_f32(AZIMUTH_TICKS_PER_RAD);
+    const float32x4_t khalf = vdupq_n_f32(0.5f);
+    const int32x4_t min_idx = vdupq_n_s32(0);
+    const int32x4_t max_idx = vdupq_n_s32(AZIMUTH_TABLE_SIZE - 1);
+    const float ch_init[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    const float32x4_t ch0 = vld1q_f32(ch_init);
+
+    for (int fir_idx = 0; fir_idx < KERNEL_FIRINGS; ++fir_idx) {
+        // One firing is exactly 48 bytes, which vld3q_u8 splits into
+        // the low byte, high byte and intensity of the 16 returns.
+        const uint8x16x3_t ret = vld3q_u8(firingData(input.packet, fir_idx));
+
+        uint16x8_t raw[2];
+        raw[0] = vorrq_u16(vmovl_u8(vget_low_u8(ret.val[0])),
+                vshlq_n_u16(vmovl_u8(vget_low_u8(ret.val[1])), 8));
+        raw[1] = vorrq_u16(vmovl_u8(vget_high_u8(ret.val[0])),
+                vshlq_n_u16(vmovl_u8(vget_high_u8(ret.val[1])), 8));
+        vst1q_u16(&output.raw_distance[fir_idx][0], raw[0]);
+        vst1q_u16(&output.raw_distance[fir_idx][8], raw[1]);
+        vst1q_u8(&output.intensity[fir_idx][0], ret.val[2]);
+
+        const float32x4_t firing_azimuth =
+                vdupq_n_f32(input.firing_azimuth[fir_idx]);
+        const float azimuth_step = input.azimuth_step[fir_idx];
+
+        for (int q = 0; q < 4; ++q) {
+            const int ch = 4*q;
+            const uint16x4_t raw_q = q%2 == 0 ?
+                        vget_low_u16(raw[q/2]) : vget_high_u16(raw[q/2]);
+            const float32x4_t distance = vmulq_n_f32(
+                        vcvtq_f32_u32(vmovl_u16(raw_q)), input.distance_resolution);
+
+            const float32x4_t channel = vaddq_f32(ch0, vdupq_n_f32(ch));
+            const float32x4_t azimuth = vaddq_f32(firing_azimuth,
+                        vmulq_n_f32(channel, azimuth_step));
+            int32x4_t idx = vcvtq_s32_f32(vaddq_f32(vmulq_f32(azimuth, kticks), khalf));
+            idx = vaddq_s32(idx, vld1q_s32(input.azimuth_offset + ch));
+            idx = vminq_s32(vmaxq_s32(idx, min_idx), max_idx);
+
+            // There is no gather, look the four lanes up one by one.
+            int32_t lanes[4];
+            float cos_az[4];
+            float sin_az[4];
+            vst1q_s32(lanes, idx);
+            for (int i = 0; i < 4; ++i) {
+                cos_az[i] = input.cos_azimuth[lanes[i]];
+                sin_az[i] = input.sin_azimuth[lanes[i]];
+            }
+
+            const float32x4_t xy = vmulq_f32(distance, vld1q_f32(input.cos_altitude + ch));
+            vst1q_f32(&output.azimuth[fir_idx][ch], azimuth);
+            vst1q_f32(&output.x[fir_idx][ch], vmulq_f32(xy, vld1q_f32(cos_az)));
+            vst1q_f32(&output.y[fir_idx][ch], vnegq_f32(vmulq_f32(xy, vld1q_f32(sin_az))));
+            vst1q_f32(&output.z[fir_idx][ch],
+                      vmulq_f32(distance, vld1q_f32(input.sin_altitude + ch)));
+        }
+    }
+    return;
+}
+#endif
+
+void fillAzimuthTables(float* cos_azimuth, float* sin_azimuth) {
+    for (int i = 0; i < AZIMUTH_TABLE_SIZE; ++i) {
+        const double angle = (i - AZIMUTH_TABLE_GUARD) * (2.0*M_PI / AZIMUTH_TICKS);
+        cos_azimuth[i] = cos(angle);
+        sin_azimuth[i] = sin(angle);
+    }
+    return;
+}
+
+int32_t azimuthTableOffset(double offset) {
+    return AZIMUTH_TABLE_GUARD + static_cast<int32_t>(
+                floor(offset * AZIMUTH_TICKS / (2.0*M_PI) + 0.5));
+}
+
+bool isDecodeKernelSupported(DecodeKernelType type) {
+    switch (type) {
+    case KERNEL_SCALAR:
+        return true;
+    case KERNEL_AVX2:
+#ifdef LSLIDAR_C16_HAVE_AVX2
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    case KERNEL_NEON:
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+DecodeKernelType bestDecodeKernel() {
+    if (isDecodeKernelSupported(KERNEL_AVX2)) return KERNEL_AVX2;
+    if (isDecodeKernelSupported(KERNEL_NEON)) return KERNEL_NEON;
+    return KERNEL_SCALAR;
+}
+
+DecodeKernel getDecodeKernel(DecodeKernelType type) {
+    if (!isDecodeKernelSupported(type)) return NULL;
+
+    switch (type) {
+#ifdef LSLIDAR_C16_HAVE_AVX2
+    case KERNEL_AVX2:
+        return decodeFiringsAvx2;
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    case KERNEL_NEON:
+        return decodeFiringsNeon;
+#endif
+    default:
+        return decodeFiringsScalar;
+    }
+}
+
+const char* decodeKernelName(DecodeKernelType type) {
+    switch (type) {
+    case KERNEL_SCALAR: return "scalar";
+    case KERNEL_AVX2:   return "avx2";
+    case KERNEL_NEON:   return "neon";
+    }
+    return "unknown";
+}
+
+} // end namespace lslidar_c16_decoder
@@ -0,0 +1,118 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Built with -mavx2. Nothing in here may be called before
+// isDecodeKernelSupported(KERNEL_AVX2) returned true.
+
+#include <cstring>
+#include <immintrin.h>
+
+#include <lslidar_c16_decoder/decode_kernels.h>
+
+namespace lslidar_c16_decoder {
+
+void decodeFiringsAvx2(const DecodeInput& input, DecodedFirings& output) {
+    // Each 128-bit lane holds four 3-byte returns in its low 12 bytes.
+    // The shuffles spread them into 32-bit distance and byte intensity.
+    const __m256i distance_shuffle = _mm256_setr_epi8(
+                0, 1, -1, -1, 3, 4, -1, -1, 6, 7, -1, -1, 9, 10, -1, -1,
+                0, 1, -1, -1, 3, 4, -1, -1, 6, 7, -1, -1, 9, 10, -1, -1);
+    const __m256i intensity_shuffle = _mm256_setr_epi8(
+                2, 5, 8, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                2, 5, 8, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    const __m256 resolution = _mm256_set1_ps(input.distance_resolution);
+    const __m256 kticks = _mm256_set1_ps(AZIMUTH_TICKS_PER_RAD);
+    const __m256 khalf = _mm256_set1_ps(0.5f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256i min_idx = _mm256_setzero_si256();
+    const __m256i max_idx = _mm256_set1_epi32(AZIMUTH_TABLE_SIZE - 1);
+    const __m256 channels[2] = {
+        _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f),
+        _mm256_setr_ps(8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f)
+    };
+    const __m256 cos_altitude[2] = {
+        _mm256_loadu_ps(input.cos_altitude),
+        _mm256_loadu_ps(input.cos_altitude + 8)
+    };
+    const __m256 sin_altitude[2] = {
+        _mm256_loadu_ps(input.sin_altitude),
+        _mm256_loadu_ps(input.sin_altitude + 8)
+    };
+    const __m256i azimuth_offset[2] = {
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input.azimuth_offset)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input.azimuth_offset + 8))
+    };
+
+    for (int fir_idx = 0; fir_idx < KERNEL_FIRINGS; ++fir_idx) {
+        const uint8_t* data = input.packet + (fir_idx/2)*KERNEL_BLOCK_SIZE +
+                KERNEL_BLOCK_HEADER + (fir_idx%2)*KERNEL_CHANNELS*KERNEL_RETURN_SIZE;
+        const __m256 firing_azimuth = _mm256_set1_ps(input.firing_azimuth[fir_idx]);
+        const __m256 azimuth_step = _mm256_set1_ps(input.azimuth_step[fir_idx]);
+
+        for (int half = 0; half < 2; ++half) {
+            const int ch = 8*half;
+
+            // Returns ch..ch+3 in the low lane and ch+4..ch+7 in the
+            // high one. The second load reads at most 4 bytes past the
+            // firing, which is still within the 1206-byte packet.
+            const uint8_t* ret = data + ch*KERNEL_RETURN_SIZE;
+            const __m256i bytes = _mm256_inserti128_si256(
+                        _mm256_castsi128_si256(_mm_loadu_si128(
+                                reinterpret_cast<const __m128i*>(ret))),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                                ret + 4*KERNEL_RETURN_SIZE)), 1);
+
+            const __m256i raw = _mm256_shuffle_epi8(bytes, distance_shuffle);
+            const __m256i intensity = _mm256_shuffle_epi8(bytes, intensity_shuffle);
+            const __m256 distance = _mm256_mul_ps(_mm256_cvtepi32_ps(raw), resolution);
+
+            const __m256 azimuth = _mm256_add_ps(firing_azimuth,
+                        _mm256_mul_ps(channels[half], azimuth_step));
+            __m256i idx = _mm256_cvttps_epi32(
+                        _mm256_add_ps(_mm256_mul_ps(azimuth, kticks), khalf));
+            idx = _mm256_add_epi32(idx, azimuth_offset[half]);
+            idx = _mm256_min_epi32(_mm256_max_epi32(idx, min_idx), max_idx);
+            const __m256 cos_az = _mm256_i32gather_ps(input.cos_azimuth, idx, 4);
+            const __m256 sin_az = _mm256_i32gather_ps(input.sin_azimuth, idx, 4);
+
+            const __m256 xy = _mm256_mul_ps(distance, cos_altitude[half]);
+            _mm256_storeu_ps(&output.azimuth[fir_idx][ch], azimuth);
+            _mm256_storeu_ps(&output.x[fir_idx][ch], _mm256_mul_ps(xy, cos_az));
+            _mm256_storeu_ps(&output.y[fir_idx][ch],
+                             _mm256_xor_ps(sign, _mm256_mul_ps(xy, sin_az)));
+            _mm256_storeu_ps(&output.z[fir_idx][ch],
+                             _mm256_mul_ps(distance, sin_altitude[half]));
+
+            // Narrow the distances to uint16. packus works per lane,
+            // so move the two useful quadwords next to each other.
+            const __m256i packed = _mm256_permute4x64_epi64(
+                        _mm256_packus_epi32(raw, raw), 0x08);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(
+                                 &output.raw_distance[fir_idx][ch]),
+                             _mm256_castsi256_si128(packed));
+
+            const uint32_t intensity_lo = _mm256_extract_epi32(intensity, 0);
+            const uint32_t intensity_hi = _mm256_extract_epi32(intensity, 4);
+            memcpy(&output.intensity[fir_idx][ch], &intensity_lo, 4);
+            memcpy(&output.intensity[fir_idx][ch+4], &intensity_hi, 4);
+        }
+    }
+    return;
+}
+
+} // end namespace lslidar_c16_decoder
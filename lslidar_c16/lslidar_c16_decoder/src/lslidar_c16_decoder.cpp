@@ -15,6 +15,8 @@
  * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+
 #include <lslidar_c16_decoder/lslidar_c16_decoder.h>
 #include <std_msgs/Int8.h>
 
@@ -23,23 +25,70 @@ using namespace std;
 namespace lslidar_c16_decoder {
 LslidarC16Decoder::LslidarC16Decoder(
         ros::NodeHandle& n, ros::NodeHandle& pn):
+    offline(false),
     nh(n),
     pnh(pn),
     publish_point_cloud(true),
+    packet_handler(&LslidarC16Decoder::detectFormat),
+    auto_format(true),
+    detect_packets(0),
+    detect_paired(0),
+    format_mismatches(0),
     is_first_sweep(true),
     last_azimuth(0.0),
+    sweep_gap(0.0),
+    next_sweep_gap(0.0),
+    sweep_missing_packets(0),
+    next_sweep_missing_packets(0),
+    sweep_completeness(1.0),
     sweep_start_time(0.0),
     // layer_num(8),
     packet_start_time(0.0),
-    sweep_data(new lslidar_c16_msgs::LslidarC16Sweep()),
-    multi_scan(new lslidar_c16_msgs::LslidarC16Layer())
+    sweep_count(0),
+    point_count(0),
+    last_sweep_start_time(0.0),
+    decode_kernel(decodeFiringsScalar),
+    statistics_period(0.0),
+    invalid_packets(statistics.addCounter("invalid packets")),
+    missing_packets(statistics.addCounter("missing packets")),
+    missing_degrees(statistics.addCounter("missing degrees")),
+    skipped_sweeps(statistics.addCounter("skipped sweeps")),
+    output_overruns(statistics.addCounter("output overruns")),
+    packet_time(statistics.addHistogram("packet time", "ns")),
+    sweep_time(statistics.addHistogram("sweep output time", "us")),
+    sweep_points(statistics.addHistogram("points per sweep", "points")),
+    sweep_period(statistics.addHistogram("sweep period", "us")),
+    sweep_jitter(statistics.addHistogram("sweep jitter", "us")),
+    sweep_coverage(statistics.addHistogram("sweep completeness", "%")),
+    diag_invalid_packets(0),
+    diag_missing_packets(0),
+    two_stage(false),
+    decode_buffer(&sweep_buffer),
+    scan_layer(0),
+    completed_missing_packets(0),
+    output_pending(false),
+    output_running(false)
     {
     return;
 }
 
+LslidarC16Decoder::~LslidarC16Decoder() {
+    if (output_thread) {
+        {
+            boost::mutex::scoped_lock lock(output_mutex);
+            output_running = false;
+            output_cond.notify_one();
+        }
+        output_thread->join();
+    }
+    return;
+}
+
 bool LslidarC16Decoder::loadParameters() {
     pnh.param<int>("point_num", point_num, 1000);
-    pnh.param<int>("channel_num", layer_num, 8);
+    int channel_num;
+    pnh.param<int>("channel_num", channel_num, 8);
+    layer_num.store(channel_num, std::memory_order_relaxed);
     pnh.param<double>("min_range", min_range, 0.5);
     pnh.param<double>("max_range", max_range, 100.0);
     pnh.param<double>("angle_disable_min", angle_disable_min,-1);
@@ -54,8 +103,65 @@ bool LslidarC16Decoder::loadParameters() {
     angle3_disable_max = tmp_max;
     ROS_WARN("switch angle from %2.2f to %2.2f in left hand rule", angle3_disable_min, angle3_disable_max);
     pnh.param<double>("frequency", frequency, 20.0);
+    if (frequency <= 0.0) {
+        ROS_ERROR("frequency must be positive");
+        return false;
+    }
+    pnh.param<double>("min_sweep_completeness", min_sweep_completeness, 0.0);
+    pnh.param<double>("statistics_period", statistics_period, 0.0);
     pnh.param<bool>("publish_point_cloud", publish_point_cloud, true);
+    pnh.param<bool>("point_cloud_ring_time", point_cloud_ring_time, false);
+    string downsample_name;
+    pnh.param<string>("downsample", downsample_name, "none");
+    pnh.param<double>("voxel_size", voxel_size, 0.2);
+    pnh.param<int>("ring_decimation", ring_decimation, 4);
+    if (downsample_name == "none") {
+        downsample = DOWNSAMPLE_NONE;
+    } else if (downsample_name == "voxel") {
+        downsample = DOWNSAMPLE_VOXEL;
+    } else if (downsample_name == "ring") {
+        downsample = DOWNSAMPLE_RING;
+    } else {
+        ROS_ERROR("Unknown downsample %s, expected none, voxel or ring",
+                  downsample_name.c_str());
+        return false;
+    }
+    if (downsample == DOWNSAMPLE_VOXEL && voxel_size <= 0.0) {
+        ROS_ERROR("voxel_size must be positive");
+        return false;
+    }
+    if (downsample == DOWNSAMPLE_RING && ring_decimation < 1) {
+        ROS_ERROR("ring_decimation must be at least 1");
+        return false;
+    }
+    pnh.param<bool>("organized_cloud", organized_cloud, false);
+    pnh.param<bool>("range_image", range_image, false);
+    pnh.param<int>("range_image_width", range_image_width, 2000);
+    if (range_image_width < 1) {
+        ROS_ERROR("range_image_width must be positive");
+        return false;
+    }
     pnh.param<bool>("publish_scan", publish_scan, false);
+    pnh.param<bool>("incremental_scan", incremental_scan, false);
+    pnh.param<int>("sectors", sectors, 0);
+    pnh.param<int>("message_pool_size", message_pool_size, 4);
+    pnh.param<bool>("two_stage", two_stage, false);
+    if (message_pool_size < 0) {
+        ROS_ERROR("message_pool_size must not be negative");
+        return false;
+    }
+    pnh.param<bool>("deskew", deskew, false);
+    pnh.param<string>("deskew_fixed_frame", deskew_fixed_frame, "odom");
+    pnh.param<int>("deskew_slices", deskew_slices, 16);
+    pnh.param<double>("deskew_timeout", deskew_timeout, 0.05);
+    if (deskew && deskew_slices < 1) {
+        ROS_ERROR("deskew_slices must be at least 1");
+        return false;
+    }
+    if (sectors < 0) {
+        ROS_ERROR("sectors must not be negative");
+        return false;
+    }
     pnh.param<bool>("apollo_interface", apollo_interface, false);
     //pnh.param<string>("fixed_frame_id", fixed_frame_id, "map");
     pnh.param<string>("frame_id", frame_id, "lslidar");
@@ -64,164 +170,665 @@ bool LslidarC16Decoder::loadParameters() {
     ROS_WARN("Using GPS timestamp or not %d", use_gps_ts);
     angle_base = M_PI*2 / point_num;
 
+    pnh.param<string>("return_mode", return_mode, "auto");
+    auto_format = return_mode == "auto";
+    if (return_mode == "auto") {
+        packet_handler = &LslidarC16Decoder::detectFormat;
+    } else if (return_mode == "single") {
+        packet_handler = &LslidarC16Decoder::processFormat<SingleReturnFormat>;
+    } else if (return_mode == "dual") {
+        packet_handler = &LslidarC16Decoder::processFormat<DualReturnFormat>;
+    } else {
+        ROS_ERROR("Unknown return_mode %s, expected auto, single or dual",
+                  return_mode.c_str());
+        return false;
+    }
+
+    pnh.param<string>("simd", simd, "auto");
+    DecodeKernelType kernel_type;
+    if (simd == "auto") {
+        kernel_type = bestDecodeKernel();
+    } else if (simd == "scalar") {
+        kernel_type = KERNEL_SCALAR;
+    } else if (simd == "avx2") {
+        kernel_type = KERNEL_AVX2;
+    } else if (simd == "neon") {
+        kernel_type = KERNEL_NEON;
+    } else {
+        ROS_ERROR("Unknown simd %s, expected auto, scalar, avx2 or neon",
+                  simd.c_str());
+        return false;
+    }
+    if (!isDecodeKernelSupported(kernel_type)) {
+        ROS_WARN("The %s decode kernel is not supported on this CPU, using scalar",
+                 decodeKernelName(kernel_type));
+        kernel_type = KERNEL_SCALAR;
+    }
+    decode_kernel = getDecodeKernel(kernel_type);
+    ROS_INFO("Using the %s decode kernel", decodeKernelName(kernel_type));
+
     if (apollo_interface)
         ROS_WARN("This is apollo interface mode");
+    return loadCalibration() && loadRoi();
+}
+
+/** @brief Read the per-channel calibration.
+ *
+ *  vertical_angles and azimuth_offsets hold 16 values in degrees, in
+ *  the order of the channels within a firing. Both are optional.
+ */
+bool LslidarC16Decoder::loadCalibration() {
+    std::vector<double> vertical_angles;
+    std::vector<double> azimuth_offsets;
+    for (int i = 0; i < SCANS_PER_FIRING; ++i) {
+        altitude[i] = scan_altitude[i];
+        azimuth_offset[i] = 0.0;
+    }
+
+    if (pnh.getParam("vertical_angles", vertical_angles)) {
+        if (vertical_angles.size() != SCANS_PER_FIRING) {
+            ROS_ERROR("vertical_angles must hold %d values", SCANS_PER_FIRING);
+            return false;
+        }
+        for (int i = 0; i < SCANS_PER_FIRING; ++i)
+            altitude[i] = vertical_angles[i] * DEG_TO_RAD;
+    }
+
+    if (pnh.getParam("azimuth_offsets", azimuth_offsets)) {
+        if (azimuth_offsets.size() != SCANS_PER_FIRING) {
+            ROS_ERROR("azimuth_offsets must hold %d values", SCANS_PER_FIRING);
+            return false;
+        }
+        for (int i = 0; i < SCANS_PER_FIRING; ++i) {
+            if (fabs(azimuth_offsets[i]) * 100.0 > MAX_AZIMUTH_OFFSET_TICKS) {
+                ROS_ERROR("azimuth_offsets must be within +-%.1f degrees",
+                          MAX_AZIMUTH_OFFSET_TICKS / 100.0);
+                return false;
+            }
+            azimuth_offset[i] = azimuth_offsets[i] * DEG_TO_RAD;
+        }
+    }
     return true;
 }
 
-bool LslidarC16Decoder::createRosIO() {
-    packet_sub = nh.subscribe<lslidar_c16_msgs::LslidarC16Packet>(
-                "lslidar_packet", 100, &LslidarC16Decoder::packetCallback, this);
+// An int or double XmlRpc value.
+static bool xmlRpcNumber(XmlRpc::XmlRpcValue& value, double& number) {
+    if (value.getType() == XmlRpc::XmlRpcValue::TypeInt) {
+        number = static_cast<int>(value);
+        return true;
+    }
+    if (value.getType() == XmlRpc::XmlRpcValue::TypeDouble) {
+        number = static_cast<double>(value);
+        return true;
+    }
+    return false;
+}
+
+static inline int azimuthTick(float azimuth) {
+    const int tick = static_cast<int>(azimuth * AZIMUTH_TICKS_PER_RAD + 0.5f);
+    return tick >= AZIMUTH_TICKS ? tick - AZIMUTH_TICKS : tick;
+}
+
+static uint16_t rawDistance(double distance, bool round_up) {
+    double raw = distance / DISTANCE_RESOLUTION;
+    raw = round_up ? ceil(raw) : floor(raw);
+    return raw < 0.0 ? 0 : raw > 65535.0 ? 65535 : static_cast<uint16_t>(raw);
+}
+
+/** @brief Build the mask of the returns worth storing.
+ *
+ *  ring_min_range and ring_max_range hold 16 limits in meters, by ring
+ *  (0 is the lowest), and default to min_range and max_range. Every
+ *  entry of exclusion_sectors is [begin, end] or [begin, end,
+ *  first_ring, last_ring], in degrees counter-clockwise from x like
+ *  the point cloud.
+ *
+ *  The angle3_disable sector only applies to the point cloud outputs
+ *  and goes into cloud_mask, the angle_disable sector only to the
+ *  LaserScan outputs and goes into scan_bin_disabled.
+ */
+bool LslidarC16Decoder::loadRoi() {
+    // angle3_disable_min and angle3_disable_max are already in the
+    // clockwise raw azimuth [rad].
+    const double cloud_begin = std::max(0.0,
+            floor(angle3_disable_min * AZIMUTH_TICKS_PER_RAD + 0.5));
+    const double cloud_end = std::min<double>(AZIMUTH_TICKS,
+            floor(angle3_disable_max * AZIMUTH_TICKS_PER_RAD + 0.5));
+    if (cloud_begin < cloud_end)
+        cloud_mask.excludeSector(0, SWEEP_RINGS - 1, cloud_begin, cloud_end - cloud_begin);
+
+    scan_bin_disabled.assign(point_num, 0);
+    for (int i = 0; i < point_num; ++i) {
+        if ((i >= angle_disable_min*point_num/360) && (i < angle_disable_max*point_num/360))
+            scan_bin_disabled[i] = 1;
+    }
+
+    std::vector<double> ring_min_range;
+    std::vector<double> ring_max_range;
+    pnh.getParam("ring_min_range", ring_min_range);
+    pnh.getParam("ring_max_range", ring_max_range);
+    if ((!ring_min_range.empty() && ring_min_range.size() != SWEEP_RINGS) ||
+            (!ring_max_range.empty() && ring_max_range.size() != SWEEP_RINGS)) {
+        ROS_ERROR("ring_min_range and ring_max_range must hold %d values", SWEEP_RINGS);
+        return false;
+    }
+    for (int i = 0; i < SWEEP_RINGS; ++i) {
+        const double ring_min = ring_min_range.empty() ? min_range : ring_min_range[i];
+        const double ring_max = ring_max_range.empty() ? max_range : ring_max_range[i];
+        roi_mask.setRange(i, rawDistance(ring_min, true), rawDistance(ring_max, false));
+    }
+
+    XmlRpc::XmlRpcValue sectors_param;
+    if (!pnh.getParam("exclusion_sectors", sectors_param))
+        return true;
+    if (sectors_param.getType() != XmlRpc::XmlRpcValue::TypeArray) {
+        ROS_ERROR("exclusion_sectors must be a list");
+        return false;
+    }
+    for (int i = 0; i < sectors_param.size(); ++i) {
+        XmlRpc::XmlRpcValue& sector = sectors_param[i];
+        double values[4] = {0.0, 0.0, 0.0, SWEEP_RINGS - 1};
+        bool valid = sector.getType() == XmlRpc::XmlRpcValue::TypeArray &&
+                (sector.size() == 2 || sector.size() == 4);
+        for (int j = 0; valid && j < sector.size(); ++j)
+            valid = xmlRpcNumber(sector[j], values[j]);
+        const int first_ring = values[2];
+        const int last_ring = values[3];
+        const double width = values[1] - values[0];
+        if (!valid || width <= 0.0 || first_ring < 0 ||
+                first_ring > last_ring || last_ring >= SWEEP_RINGS) {
+            ROS_ERROR("exclusion_sectors entry %d must be [begin, end] or "
+                      "[begin, end, first_ring, last_ring], begin < end", i);
+            return false;
+        }
+
+        // The raw azimuth runs clockwise, the sector ends where it begins.
+        int begin = static_cast<int>(floor((360.0 - values[1]) * 100.0 + 0.5)) % AZIMUTH_TICKS;
+        if (begin < 0) begin += AZIMUTH_TICKS;
+        roi_mask.excludeSector(first_ring, last_ring, begin,
+                               static_cast<int>(floor(width * 100.0 + 0.5)));
+        ROS_INFO("Excluding %.2f to %.2f degrees on rings %d to %d",
+                 values[0], values[1], first_ring, last_ring);
+    }
+    return true;
+}
+
+bool LslidarC16Decoder::createRosIO(PacketSource source) {
+    // Offline, the publishers stay invalid and publish nothing, but
+    // every enabled output is still built.
+    offline = source == OFFLINE;
+    if (offline)
+        return true;
+
+    if (source == PACKET_TOPIC)
+        packet_sub = nh.subscribe<lslidar_c16_msgs::LslidarC16Packet>(
+                    "lslidar_packet", 100, &LslidarC16Decoder::packetCallback, this);
     layer_sub = nh.subscribe(
                 "layer_num", 100, &LslidarC16Decoder::layerCallback, this);
     sweep_pub = nh.advertise<lslidar_c16_msgs::LslidarC16Sweep>(
                 "lslidar_sweep", 10);
+    compact_sweep_pub = nh.advertise<lslidar_c16_msgs::LslidarC16CompactSweep>(
+                "lslidar_compact_sweep", 10);
     point_cloud_pub = nh.advertise<sensor_msgs::PointCloud2>(
                 "lslidar_point_cloud", 10);
     scan_pub = nh.advertise<sensor_msgs::LaserScan>(
                 "scan", 100);
     channel_scan_pub = nh.advertise<lslidar_c16_msgs::LslidarC16Layer>(
                 "scan_channel", 100);
+    if (sectors > 0)
+        sector_pub = nh.advertise<sensor_msgs::PointCloud2>(
+                    "lslidar_point_cloud_sector", 10);
+    if (organized_cloud)
+        organized_cloud_pub = nh.advertise<sensor_msgs::PointCloud2>(
+                    "lslidar_point_cloud_organized", 10);
+    if (range_image) {
+        range_image_pub = nh.advertise<sensor_msgs::Image>("range_image", 10);
+        intensity_image_pub = nh.advertise<sensor_msgs::Image>("intensity_image", 10);
+    }
+
+    // The reports only read atomics, so the timer may run next to a
+    // thread that calls processPacket().
+    diagnostics.reset(new diagnostic_updater::Updater(nh, pnh));
+    diagnostics->setHardwareID("Lslidar_C16");
+    diagnostics->add("decoder statistics", boost::bind(
+        &LslidarC16Decoder::statisticsDiagnostics, this, _1));
+    diagnostic_timer = nh.createWallTimer(
+                ros::WallDuration(0.5), &LslidarC16Decoder::diagnosticTimer, this);
+    statistics_pub.start(statistics, nh, "lslidar_decoder_statistics",
+                         "decoder", statistics_period);
     return true;
 }
 
-bool LslidarC16Decoder::initialize() {
+void LslidarC16Decoder::diagnosticTimer(const ros::WallTimerEvent& event) {
+    diagnostics->update();
+}
+
+void LslidarC16Decoder::statisticsDiagnostics(
+        diagnostic_updater::DiagnosticStatusWrapper& stat) {
+    const uint64_t invalid = invalid_packets.load(std::memory_order_relaxed);
+    const uint64_t missing = missing_packets.load(std::memory_order_relaxed);
+    if (invalid != diag_invalid_packets)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "invalid packets received");
+    else if (missing != diag_missing_packets)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "packets missing");
+    else
+        stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "no invalid or missing packets");
+    diag_invalid_packets = invalid;
+    diag_missing_packets = missing;
+    statistics.report(diag_statistics, stat);
+}
+
+bool LslidarC16Decoder::initialize(PacketSource source) {
     if (!loadParameters()) {
         ROS_ERROR("Cannot load all required parameters...");
         return false;
     }
 
-    if (!createRosIO()) {
+    if (!createRosIO(source)) {
         ROS_ERROR("Cannot create ROS I/O...");
         return false;
     }
 
-    // Fill in the altitude for each scan.
-    for (size_t scan_idx = 0; scan_idx < 16; ++scan_idx) {
-        size_t remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
-        sweep_data->scans[remapped_scan_idx].altitude = scan_altitude[scan_idx];
+    sweep_buffer.allocate(MAX_POINTS_PER_RING);
+    cloud_points.reserve(SWEEP_RINGS * MAX_POINTS_PER_RING);
+    if (downsample == DOWNSAMPLE_VOXEL)
+        voxel_filter.allocate(SWEEP_RINGS * MAX_POINTS_PER_RING, voxel_size);
+
+    sweep_pool.resize(message_pool_size);
+    compact_sweep_pool.resize(message_pool_size);
+    layer_pool.resize(message_pool_size);
+    scan_pool.resize(message_pool_size);
+    cloud_pool.resize(message_pool_size);
+
+    // Bins of the incremental scan. The disabled angles never get a point.
+    scan_bin_layer = layer_num.load(std::memory_order_relaxed);
+    scan_bins_active = publish_scan && incremental_scan && wanted(scan_pub);
+    scan_bin_scale = 1.0 / angle_base;
+    resetScanBins(layer_bins);
+    resetScanBins(output_bins);
+
+    if (deskew && source != OFFLINE) {
+        tf_listener.reset(new tf::TransformListener(nh));
+        deskew_transforms.resize(deskew_slices * 12);
     }
 
-    // Create the sin and cos table for different azimuth values.
-    for (size_t i = 0; i < 6300; ++i) {
-        double angle = static_cast<double>(i) / 1000.0;
-        cos_azimuth_table[i] = cos(angle);
-        sin_azimuth_table[i] = sin(angle);
+    current_sector = 0;
+    sector_scale = sectors / (2.0*M_PI);
+    for (int i = 0; i < SWEEP_RINGS; ++i)
+        sector_begin[i] = 0;
+
+    // Create the sin and cos table for every raw azimuth value. The
+    // calibration is folded into the per-channel tables.
+    cos_azimuth_table.resize(AZIMUTH_TABLE_SIZE);
+    sin_azimuth_table.resize(AZIMUTH_TABLE_SIZE);
+    fillAzimuthTables(&cos_azimuth_table[0], &sin_azimuth_table[0]);
+
+    for (size_t i = 0; i < SCANS_PER_FIRING; ++i) {
+        cos_altitude_table[i] = cos(altitude[i]);
+        sin_altitude_table[i] = sin(altitude[i]);
+        azimuth_offset_table[i] = azimuthTableOffset(azimuth_offset[i]);
     }
 
+    decode_input.packet = NULL;
+    decode_input.cos_azimuth = &cos_azimuth_table[0];
+    decode_input.sin_azimuth = &sin_azimuth_table[0];
+    decode_input.azimuth_offset = azimuth_offset_table;
+    decode_input.cos_altitude = cos_altitude_table;
+    decode_input.sin_altitude = sin_altitude_table;
+    decode_input.distance_resolution = DISTANCE_RESOLUTION;
+
+    // Offline, the outputs are built right away, so that the time
+    // spent on them is part of processPacket().
+    if (two_stage && !offline) {
+        pipeline_buffer.allocate(MAX_POINTS_PER_RING);
+        decode_buffer = &pipeline_buffer;
+        output_running = true;
+        output_thread.reset(new boost::thread(
+                boost::bind(&LslidarC16Decoder::outputLoop, this)));
+        ROS_INFO("Building the sweep outputs on their own thread");
+    } else {
+        two_stage = false;
+    }
     return true;
 }
 
+template <typename Format>
 bool LslidarC16Decoder::checkPacketValidity(const RawPacket* packet) {
     for (size_t blk_idx = 0; blk_idx < BLOCKS_PER_PACKET; ++blk_idx) {
-        if (packet->blocks[blk_idx].header != UPPER_BANK) {
+        if (packet->blocks[blk_idx].header != Format::BLOCK_HEADER) {
             //ROS_WARN("Skip invalid LS-16 packet: block %lu header is %x",
                     //blk_idx, packet->blocks[blk_idx].header);
+            invalid_packets.fetch_add(1, std::memory_order_relaxed);
             return false;
         }
     }
     return true;
 }
 
+bool LslidarC16Decoder::pairedBlocks(const RawPacket* packet) {
+    for (size_t blk_idx = 0; blk_idx < BLOCKS_PER_PACKET; blk_idx += 2) {
+        if (packet->blocks[blk_idx].rotation != packet->blocks[blk_idx+1].rotation)
+            return false;
+    }
+    return true;
+}
 
-void LslidarC16Decoder::publishPointCloud() {
-//    VPointCloud::Ptr point_cloud(new VPointCloud());
-    pcl::PointCloud<pcl::PointXYZI>::Ptr point_cloud(new pcl::PointCloud<pcl::PointXYZI>);
-            // pcl_conversions::toPCL(sweep_data->header).stamp;
-    point_cloud->header.frame_id = frame_id;
-    point_cloud->height = 1;
-
-    for (size_t i = 0; i < 16; ++i) {
-        const lslidar_c16_msgs::LslidarC16Scan& scan = sweep_data->scans[i];
+
+static void addPointField(sensor_msgs::PointCloud2& cloud, const char* name,
+                          uint32_t offset, uint8_t datatype) {
+    sensor_msgs::PointField field;
+    field.name = name;
+    field.offset = offset;
+    field.datatype = datatype;
+    field.count = 1;
+    cloud.fields.push_back(field);
+}
+
+void LslidarC16Decoder::initPointCloudFields(
+        sensor_msgs::PointCloud2& cloud, CloudLayout layout) {
+    cloud.fields.clear();
+    addPointField(cloud, "x", 0, sensor_msgs::PointField::FLOAT32);
+    addPointField(cloud, "y", 4, sensor_msgs::PointField::FLOAT32);
+    addPointField(cloud, "z", 8, sensor_msgs::PointField::FLOAT32);
+    addPointField(cloud, "intensity", 12, sensor_msgs::PointField::FLOAT32);
+
+    switch (layout) {
+    case CLOUD_XYZI:
+        cloud.point_step = CLOUD_POINT_STEP;
+        break;
+    case CLOUD_XYZIT:
+        addPointField(cloud, "time", 16, sensor_msgs::PointField::FLOAT32);
+        cloud.point_step = SECTOR_POINT_STEP;
+        break;
+    case CLOUD_XYZIRT:
+        addPointField(cloud, "ring", offsetof(PackedPointXYZIRT, ring),
+                      sensor_msgs::PointField::UINT16);
+        addPointField(cloud, "time", offsetof(PackedPointXYZIRT, time),
+                      sensor_msgs::PointField::FLOAT32);
+        cloud.point_step = sizeof(PackedPointXYZIRT);
+        break;
+    case CLOUD_MERGED:
+        addPointField(cloud, "ring", 16, sensor_msgs::PointField::UINT16);
+        addPointField(cloud, "lidar", 18, sensor_msgs::PointField::UINT16);
+        addPointField(cloud, "time", 20, sensor_msgs::PointField::FLOAT32);
+        cloud.point_step = MERGED_POINT_STEP;
+        break;
+    }
+    cloud.is_bigendian = false;
+    cloud.is_dense = true;
+    cloud.height = 1;
+}
+
+bool LslidarC16Decoder::sweepTimeSpan(float& first_time, float& last_time) {
+    // The points of a ring are in time order.
+    first_time = std::numeric_limits<float>::max();
+    last_time = 0.0f;
+    for (int i = 0; i < SWEEP_RINGS; ++i) {
+        if (sweep_buffer.size[i] == 0) continue;
+        first_time = std::min(first_time, sweep_buffer.time[sweep_buffer.begin(i)]);
+        last_time = std::max(last_time, sweep_buffer.time[sweep_buffer.end(i) - 1]);
+    }
+    return last_time > first_time;
+}
+
+ros::Time LslidarC16Decoder::sweepTimeBase(float last_time) {
+    // Point times are relative to the sweep start, which is also
+    // sweep_stamp with GPS stamps. Without them the sweep is taken to
+    // end at sweep_stamp.
+    return use_gps_ts ? sweep_stamp :
+            sweep_stamp - ros::Duration(last_time * 1e-6);
+}
+
+bool LslidarC16Decoder::inCloud(const SweepBuffer& buffer, int ring, size_t j) const {
+    return !cloud_mask.sectors ||
+            cloud_mask.contains(ring, buffer.distance[j], azimuthTick(buffer.azimuth[j]));
+}
+
+void LslidarC16Decoder::selectCloudPoints() {
+    cloud_points.clear();
+    if (downsample == DOWNSAMPLE_VOXEL)
+        voxel_filter.clear();
+
+    for (int i = 0; i < 16; ++i) {
         // The first and last point in each scan is ignored, which
         // seems to be corrupted based on the received data.
         // TODO: The two end points should be removed directly
         //    in the scans.
-        double timestamp = ros::Time::now().toSec();
-        if (use_gps_ts){
-            point_cloud->header.stamp = static_cast<uint64_t>(sweep_start_time * 1e6);
+        if (sweep_buffer.size[i] == 0) continue;
+        const size_t end = sweep_buffer.end(i) - 1;
+        int ring_count = 0;
+        for (size_t j = sweep_buffer.begin(i) + 1; j < end; ++j) {
+            if (!inCloud(sweep_buffer, i, j)) continue;
+
+            if (downsample == DOWNSAMPLE_RING) {
+                if (ring_count++ % ring_decimation != 0) continue;
+            } else if (downsample == DOWNSAMPLE_VOXEL) {
+                if (!voxel_filter.insert(sweep_buffer.x[j], sweep_buffer.y[j],
+                                         sweep_buffer.z[j]))
+                    continue;
+            }
+            cloud_points.push_back(j);
         }
-        else{
-            point_cloud->header.stamp = static_cast<uint64_t>(timestamp * 1e6);
+    }
+    return;
+}
+
+// Write one point of lslidar_point_cloud in the layout set up by
+// initPointCloudFields(), CLOUD_XYZIRT or its CLOUD_XYZI head.
+static inline void writeCloudPoint(uint8_t* ptr, bool ring_time,
+                                   float x, float y, float z, float intensity,
+                                   uint16_t ring, float time) {
+    PackedPointXYZIRT* point = reinterpret_cast<PackedPointXYZIRT*>(ptr);
+    point->x = x;
+    point->y = y;
+    point->z = z;
+    point->intensity = intensity;
+    if (ring_time) {
+        point->ring = ring;
+        point->padding = 0;
+        point->time = time;
+    }
+}
+
+sensor_msgs::PointCloud2Ptr LslidarC16Decoder::allocatePointCloud(
+        const ros::Time& stamp, size_t num_points) {
+    sensor_msgs::PointCloud2Ptr cloud = cloud_pool.acquire();
+    cloud->header.frame_id = frame_id;
+    cloud->header.stamp = stamp;
+    initPointCloudFields(*cloud, point_cloud_ring_time ? CLOUD_XYZIRT : CLOUD_XYZI);
+    cloud->width = num_points;
+    cloud->row_step = num_points * cloud->point_step;
+    cloud->data.resize(cloud->row_step);
+    return cloud;
+}
+
+void LslidarC16Decoder::publishPointCloud() {
+    const ros::Time& stamp = cloud_stamp;
+
+    // Offset from the cloud stamp to the sweep start [s].
+    float time_offset = 0.0f;
+    if (point_cloud_ring_time) {
+        float first_time, last_time;
+        sweepTimeSpan(first_time, last_time);
+        time_offset = (sweepTimeBase(last_time) - stamp).toSec();
+    }
+
+    selectCloudPoints();
+
+    // Write the points straight into the message buffer, which is
+    // sized once for the whole sweep, instead of going through a
+    // pcl::PointCloud and pcl::toROSMsg.
+    const size_t num_points = cloud_points.size();
+    sensor_msgs::PointCloud2Ptr cloud = allocatePointCloud(stamp, num_points);
+    const uint32_t point_step = cloud->point_step;
+
+    uint8_t* ptr = cloud->data.empty() ? NULL : &cloud->data[0];
+    for (size_t k = 0; k < num_points; ++k) {
+        const size_t j = cloud_points[k];
+        writeCloudPoint(ptr, point_cloud_ring_time,
+                        sweep_buffer.x[j], sweep_buffer.y[j], sweep_buffer.z[j],
+                        sweep_buffer.intensity[j], j / sweep_buffer.capacity,
+                        time_offset + sweep_buffer.time[j] * 1e-6f);
+        ptr += point_step;
+    }
+
+    if (point_cloud_pub) point_cloud_pub.publish(cloud);
+    return;
+}
+
+size_t LslidarC16Decoder::appendMergedPoints(
+        sensor_msgs::PointCloud2& cloud, const float* transform,
+        float time_offset, uint16_t lidar) const {
+    const float* m = transform;
+    const size_t begin = cloud.data.size();
+    cloud.data.resize(begin + sweep_buffer.totalSize() * MERGED_POINT_STEP);
+
+    uint8_t* ptr = cloud.data.empty() ? NULL : &cloud.data[begin];
+    size_t num_points = 0;
+    for (int i = 0; i < 16; ++i) {
+        // Same selection as publishPointCloud().
+        if (sweep_buffer.size[i] == 0) continue;
+        const size_t end = sweep_buffer.end(i) - 1;
+        for (size_t j = sweep_buffer.begin(i) + 1; j < end; ++j) {
+            if (!inCloud(sweep_buffer, i, j)) continue;
+
+            const float x = sweep_buffer.x[j];
+            const float y = sweep_buffer.y[j];
+            const float z = sweep_buffer.z[j];
+            float* fields = reinterpret_cast<float*>(ptr);
+            fields[0] = m[0]*x + m[1]*y + m[2]*z + m[3];
+            fields[1] = m[4]*x + m[5]*y + m[6]*z + m[7];
+            fields[2] = m[8]*x + m[9]*y + m[10]*z + m[11];
+            fields[3] = sweep_buffer.intensity[j];
+            *reinterpret_cast<uint16_t*>(ptr + 16) = i;
+            *reinterpret_cast<uint16_t*>(ptr + 18) = lidar;
+            fields[5] = time_offset + sweep_buffer.time[j] * 1e-6f;
+            ptr += MERGED_POINT_STEP;
+            ++num_points;
         }
+    }
 
-        if (scan.points.size() == 0) continue;
-        size_t j;
-        pcl::PointXYZI point;
-        for (j = 1; j < scan.points.size()-1; ++j) {
-            if ((scan.points[j].azimuth > angle3_disable_min) and (scan.points[j].azimuth < angle3_disable_max))
-            {
-                continue;
+    cloud.data.resize(begin + num_points * MERGED_POINT_STEP);
+    cloud.width += num_points;
+    cloud.row_step = cloud.width * MERGED_POINT_STEP;
+    return num_points;
+}
+
+void LslidarC16Decoder::publishOrganized() {
+    const bool want_cloud = organized_cloud && wanted(organized_cloud_pub);
+    const bool want_images = range_image &&
+            (wanted(range_image_pub) || wanted(intensity_image_pub));
+    if (!want_cloud && !want_images) return;
+
+    // Row 0 is the highest ring, column c holds the returns closest
+    // to the raw azimuth c * 2pi / width.
+    const int width = range_image_width;
+    const float column_scale = width / (2.0*M_PI);
+
+    sensor_msgs::PointCloud2Ptr cloud;
+    float time_offset = 0.0f;
+    if (want_cloud) {
+        cloud.reset(new sensor_msgs::PointCloud2());
+        cloud->header.frame_id = frame_id;
+        cloud->header.stamp = cloud_stamp;
+        initPointCloudFields(*cloud, point_cloud_ring_time ? CLOUD_XYZIRT : CLOUD_XYZI);
+        cloud->height = SWEEP_RINGS;
+        cloud->width = width;
+        cloud->row_step = width * cloud->point_step;
+        cloud->is_dense = false;
+        cloud->data.resize(cloud->height * cloud->row_step);
+
+        // Cells without a return are NaN.
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        for (int row = 0; row < SWEEP_RINGS; ++row) {
+            for (int col = 0; col < width; ++col) {
+                uint8_t* cell = &cloud->data[row * cloud->row_step + col * cloud->point_step];
+                float* fields = reinterpret_cast<float*>(cell);
+                fields[0] = fields[1] = fields[2] = nan;
+                if (point_cloud_ring_time)
+                    *reinterpret_cast<uint16_t*>(cell + 16) = SWEEP_RINGS - 1 - row;
             }
-            point.x = scan.points[j].x;
-            point.y = scan.points[j].y;
-            point.z = scan.points[j].z;
-            point.intensity = scan.points[j].intensity;
-            point_cloud->points.push_back(point);
-            ++point_cloud->width;
+        }
+
+        if (point_cloud_ring_time) {
+            float first_time, last_time;
+            sweepTimeSpan(first_time, last_time);
+            time_offset = (sweepTimeBase(last_time) - cloud_stamp).toSec();
         }
     }
 
-    sensor_msgs::PointCloud2 pc_msg;
-    pcl::toROSMsg(*point_cloud, pc_msg);
-    point_cloud_pub.publish(pc_msg);
+    sensor_msgs::ImagePtr range;
+    sensor_msgs::ImagePtr intensity;
+    if (want_images) {
+        range.reset(new sensor_msgs::Image());
+        range->header.frame_id = frame_id;
+        range->header.stamp = cloud_stamp;
+        range->height = SWEEP_RINGS;
+        range->width = width;
+        range->encoding = "16UC1";
+        range->is_bigendian = false;
+        range->step = width * sizeof(uint16_t);
+        range->data.resize(range->height * range->step);
+
+        intensity.reset(new sensor_msgs::Image());
+        intensity->header = range->header;
+        intensity->height = SWEEP_RINGS;
+        intensity->width = width;
+        intensity->encoding = "mono8";
+        intensity->is_bigendian = false;
+        intensity->step = width;
+        intensity->data.resize(intensity->height * intensity->step);
+    }
 
+    for (int i = 0; i < SWEEP_RINGS; ++i) {
+        const int row = SWEEP_RINGS - 1 - i;
+        const size_t end = sweep_buffer.end(i);
+        for (size_t j = sweep_buffer.begin(i); j < end; ++j) {
+            if (!inCloud(sweep_buffer, i, j)) continue;
+            const float azimuth = sweep_buffer.azimuth[j];
+            int col = static_cast<int>(azimuth * column_scale + 0.5f);
+            if (col >= width) col -= width;
+
+            if (cloud) {
+                uint8_t* cell = &cloud->data[row * cloud->row_step + col * cloud->point_step];
+                float* fields = reinterpret_cast<float*>(cell);
+                fields[0] = sweep_buffer.x[j];
+                fields[1] = sweep_buffer.y[j];
+                fields[2] = sweep_buffer.z[j];
+                fields[3] = sweep_buffer.intensity[j];
+                if (point_cloud_ring_time)
+                    fields[5] = time_offset + sweep_buffer.time[j] * 1e-6f;
+            }
+            if (range) {
+                // Raw distance in DISTANCE_RESOLUTION units, 0 is no return.
+                reinterpret_cast<uint16_t*>(&range->data[row * range->step])[col] =
+                        sweep_buffer.distance[j];
+                intensity->data[row * intensity->step + col] = sweep_buffer.intensity[j];
+            }
+        }
+    }
+
+    if (cloud && organized_cloud_pub) organized_cloud_pub.publish(cloud);
+    if (range && range_image_pub) range_image_pub.publish(range);
+    if (intensity && intensity_image_pub) intensity_image_pub.publish(intensity);
     return;
 }
 
-// void LslidarC16Decoder::publishPointCloud() {
-//     pcl::PointCloud<pcl::PointXYZIT>::Ptr point_cloud(
-//                 new pcl::PointCloud<pcl::PointXYZIT>());
-//     point_cloud->header.stamp =
-//             pcl_conversions::toPCL(sweep_data->header).stamp;
-//     point_cloud->header.frame_id = frame_id;
-//     point_cloud->height = 1;
-
-//     for (size_t i = 0; i < 16; ++i) {
-//         const lslidar_c16_msgs::LslidarC16Scan& scan = sweep_data->scans[i];
-//         // The first and last point in each scan is ignored, which
-//         // seems to be corrupted based on the received data.
-//         // TODO: The two end points should be removed directly
-//         //    in the scans.
-//         if (scan.points.size() == 0) continue;
-//         size_t j;
-//         for (j = 1; j < scan.points.size()-1; ++j) {
-
-//             pcl::PointXYZIT point;
-//             point.x = scan.points[j].x;
-//             point.y = scan.points[j].y;
-//             point.z = scan.points[j].z;
-//             point.intensity = scan.points[j].intensity;
-//             point.timestamp = ros::Time::now();
-//             point_cloud->points.push_back(point);
-//             ++point_cloud->width;
-//         }
-
-//     }
-
-//     //  	if(point_cloud->width > 2000)
-//     {
-//         point_cloud_pub.publish(point_cloud);
-//     }
-//     return;
-// }
-
-void LslidarC16Decoder::publishChannelScan()
+void LslidarC16Decoder::publishChannelScan(bool publish_layer)
 {
-    multi_scan = lslidar_c16_msgs::LslidarC16LayerPtr(
-                    new lslidar_c16_msgs::LslidarC16Layer());
-    // lslidar_c16_msgs::LslidarC16Layer multi_scan(new lslidar_c16_msgs::LslidarC16Layer);
-    sensor_msgs::LaserScan scan;
-
-    int layer_num_local = layer_num;
+    int layer_num_local = scan_layer;
     ROS_INFO_ONCE("default channel is %d", layer_num_local );
-    if(sweep_data->scans[layer_num_local].points.size() <= 1)
+    if(sweep_buffer.size[layer_num_local] <= 1)
         return;
 
+    // The scans of a recycled layer keep the capacity of their vectors.
+    lslidar_c16_msgs::LslidarC16LayerPtr multi_scan = layer_pool.acquire();
+
     for (uint16_t j=0; j<16; j++)
     {
+    sensor_msgs::LaserScan& scan = multi_scan->scan_channel[j];
     scan.header.frame_id = frame_id;
-    scan.header.stamp = sweep_data->header.stamp;
+    scan.header.stamp = sweep_stamp;
 
     scan.angle_min = 0.0;
     scan.angle_max = 2.0*M_PI;
@@ -230,15 +837,12 @@ void LslidarC16Decoder::publishChannelScan()
     //	scan.time_increment = motor_speed_/1e8;
     scan.range_min = min_range;
     scan.range_max = max_range;
-    scan.ranges.reserve(point_num);
     scan.ranges.assign(point_num, std::numeric_limits<float>::infinity());
-
-    scan.intensities.reserve(point_num);
     scan.intensities.assign(point_num, std::numeric_limits<float>::infinity());
 
-    for(uint16_t i = 0; i < sweep_data->scans[j].points.size(); i++)
+    for(size_t i = sweep_buffer.begin(j); i < sweep_buffer.end(j); i++)
     {
-        double point_azimuth = sweep_data->scans[j].points[i].azimuth;
+        double point_azimuth = sweep_buffer.azimuth[i];
         int point_idx = point_azimuth / angle_base;
         if (fmod(point_azimuth, angle_base) > (angle_base/2.0))
         {
@@ -250,36 +854,36 @@ void LslidarC16Decoder::publishChannelScan()
         if (point_idx < 0)
             point_idx = point_num - 1;
 
-        scan.ranges[point_num - 1-point_idx] = sweep_data->scans[j].points[i].distance;
-        scan.intensities[point_num - 1-point_idx] = sweep_data->scans[j].points[i].intensity;
+        scan.ranges[point_num - 1-point_idx] = sweep_buffer.distance[i] * DISTANCE_RESOLUTION;
+        scan.intensities[point_num - 1-point_idx] = sweep_buffer.intensity[i];
     }
 
     for (int i = point_num - 1; i >= 0; i--)
 	{
-		if((i >= angle_disable_min*point_num/360) && (i < angle_disable_max*point_num/360))
+		if (scan_bin_disabled[i])
 			scan.ranges[i] = std::numeric_limits<float>::infinity();
 	}
 
-        multi_scan->scan_channel[j] = scan;
-        if (j == layer_num_local)
-            scan_pub.publish(scan);
+        if (publish_layer && j == layer_num_local)
+            if (scan_pub) scan_pub.publish(scan);
     }
 
-    channel_scan_pub.publish(multi_scan);  
+    if (channel_scan_pub) channel_scan_pub.publish(multi_scan);
 
 }
 
 
 void LslidarC16Decoder::publishScan()
 {
-    sensor_msgs::LaserScan::Ptr scan(new sensor_msgs::LaserScan);
-    int layer_num_local = layer_num;
+    int layer_num_local = scan_layer;
     ROS_INFO_ONCE("default channel is %d", layer_num_local);
-    if(sweep_data->scans[layer_num_local].points.size() <= 1)
+    if(sweep_buffer.size[layer_num_local] <= 1)
         return;
 
+    sensor_msgs::LaserScan::Ptr scan = scan_pool.acquire();
+
     scan->header.frame_id = frame_id;
-    scan->header.stamp = sweep_data->header.stamp;
+    scan->header.stamp = sweep_stamp;
 
     scan->angle_min = 0.0;
     scan->angle_max = 2.0*M_PI;
@@ -288,15 +892,14 @@ void LslidarC16Decoder::publishScan()
     //	scan->time_increment = motor_speed_/1e8;
     scan->range_min = min_range;
     scan->range_max = max_range;
-    scan->ranges.reserve(point_num);
     scan->ranges.assign(point_num, std::numeric_limits<float>::infinity());
 
-    scan->intensities.reserve(point_num);
     scan->intensities.assign(point_num, std::numeric_limits<float>::infinity());
 
-    for(uint16_t i = 0; i < sweep_data->scans[layer_num_local].points.size(); i++)
+    for(size_t i = sweep_buffer.begin(layer_num_local);
+        i < sweep_buffer.end(layer_num_local); i++)
     {
-        double point_azimuth = sweep_data->scans[layer_num_local].points[i].azimuth;
+        double point_azimuth = sweep_buffer.azimuth[i];
         int point_idx = point_azimuth / angle_base;
 		//printf("deg %3.2f ,point idx %d, \t", point_azimuth*RAD_TO_DEG, point_idx);
         if (fmod(point_azimuth, angle_base) > (angle_base/2.0))
@@ -310,17 +913,17 @@ void LslidarC16Decoder::publishScan()
         if (point_idx < 0)
             point_idx = point_num - 1;
 
-        scan->ranges[point_num - 1-point_idx] = sweep_data->scans[layer_num_local].points[i].distance;
-        scan->intensities[point_num - 1-point_idx] = sweep_data->scans[layer_num_local].points[i].intensity;
+        scan->ranges[point_num - 1-point_idx] = sweep_buffer.distance[i] * DISTANCE_RESOLUTION;
+        scan->intensities[point_num - 1-point_idx] = sweep_buffer.intensity[i];
     }
 
     for (int i = point_num - 1; i >= 0; i--)
 	{
-		if((i >= angle_disable_min*point_num/360) && (i < angle_disable_max*point_num/360))
+		if (scan_bin_disabled[i])
 			scan->ranges[i] = std::numeric_limits<float>::infinity();
 	}
 
-    scan_pub.publish(scan);
+    if (scan_pub) scan_pub.publish(scan);
 
 }
 
@@ -351,22 +954,24 @@ point_struct LslidarC16Decoder::getMeans(std::vector<point_struct> clusters)
     return tmp;
 }
 
+template <typename Format>
 void LslidarC16Decoder::decodePacket(const RawPacket* packet) {
+    static const size_t FIRINGS = Format::FIRINGS;
 
     // Compute the azimuth angle for each firing.
-    for (size_t fir_idx = 0; fir_idx < FIRINGS_PER_PACKET; fir_idx+=2) {
-        size_t blk_idx = fir_idx / 2;
+    for (size_t fir_idx = 0; fir_idx < FIRINGS; fir_idx+=2) {
+        size_t blk_idx = Format::firing(fir_idx, 0) / FIRINGS_PER_BLOCK;
         firings[fir_idx].firing_azimuth = rawAzimuthToDouble(
                     packet->blocks[blk_idx].rotation);
     }
 
     // Interpolate the azimuth values
-    for (size_t fir_idx = 1; fir_idx < FIRINGS_PER_PACKET; fir_idx+=2) {
+    for (size_t fir_idx = 1; fir_idx < FIRINGS; fir_idx+=2) {
         size_t lfir_idx = fir_idx - 1;
         size_t rfir_idx = fir_idx + 1;
 
         double azimuth_diff;
-        if (fir_idx == FIRINGS_PER_PACKET - 1) {
+        if (fir_idx == FIRINGS - 1) {
             lfir_idx = fir_idx - 3;
             rfir_idx = fir_idx - 1;
         }
@@ -384,42 +989,29 @@ void LslidarC16Decoder::decodePacket(const RawPacket* packet) {
                     firings[fir_idx].firing_azimuth-2*M_PI : firings[fir_idx].firing_azimuth;
     }
 
-    // Fill in the distance and intensity for each firing.
-    for (size_t blk_idx = 0; blk_idx < BLOCKS_PER_PACKET; ++blk_idx) {
-        const RawBlock& raw_block = packet->blocks[blk_idx];
-
-        for (size_t blk_fir_idx = 0; blk_fir_idx < FIRINGS_PER_BLOCK; ++blk_fir_idx){
-            size_t fir_idx = blk_idx*FIRINGS_PER_BLOCK + blk_fir_idx;
-
-            double azimuth_diff = 0.0;
-            if (fir_idx < FIRINGS_PER_PACKET - 1)
-                azimuth_diff = firings[fir_idx+1].firing_azimuth -
-                        firings[fir_idx].firing_azimuth;
-            else
-                azimuth_diff = firings[fir_idx].firing_azimuth -
-                        firings[fir_idx-1].firing_azimuth;
-
-            for (size_t scan_fir_idx = 0; scan_fir_idx < SCANS_PER_FIRING; ++scan_fir_idx){
-                size_t byte_idx = RAW_SCAN_SIZE * (
-                            SCANS_PER_FIRING*blk_fir_idx + scan_fir_idx);
-
-                // Azimuth
-                firings[fir_idx].azimuth[scan_fir_idx] = firings[fir_idx].firing_azimuth +
-                        (scan_fir_idx*DSR_TOFFSET/FIRING_TOFFSET) * azimuth_diff;
-
-                // Distance
-                TwoBytes raw_distance;
-                raw_distance.bytes[0] = raw_block.data[byte_idx];
-                raw_distance.bytes[1] = raw_block.data[byte_idx+1];
-                firings[fir_idx].distance[scan_fir_idx] = static_cast<double>(
-                            raw_distance.distance) * DISTANCE_RESOLUTION;
-
-                // Intensity
-                firings[fir_idx].intensity[scan_fir_idx] = static_cast<double>(
-                            raw_block.data[byte_idx+2]);
-            }
+    // The azimuth step between two channels of a firing. All returns
+    // of a firing share its azimuths.
+    for (size_t fir_idx = 0; fir_idx < FIRINGS; ++fir_idx) {
+        double azimuth_diff = 0.0;
+        if (fir_idx < FIRINGS - 1)
+            azimuth_diff = firings[fir_idx+1].firing_azimuth -
+                    firings[fir_idx].firing_azimuth;
+        else
+            azimuth_diff = firings[fir_idx].firing_azimuth -
+                    firings[fir_idx-1].firing_azimuth;
+        azimuth_diff = azimuth_diff < 0 ? azimuth_diff + 2*M_PI : azimuth_diff;
+
+        for (int ret = 0; ret < Format::RETURNS; ++ret) {
+            const int blk_fir_idx = Format::firing(fir_idx, ret);
+            decode_input.firing_azimuth[blk_fir_idx] = firings[fir_idx].firing_azimuth;
+            decode_input.azimuth_step[blk_fir_idx] = DSR_TOFFSET/FIRING_TOFFSET * azimuth_diff;
         }
     }
+
+    // Fill in the azimuth, distance, intensity and xyz for each return.
+    decode_input.packet = reinterpret_cast<const uint8_t*>(packet);
+    decode_kernel(decode_input, decoded_firings);
+
     // for (size_t fir_idx = 0; fir_idx < FIRINGS_PER_PACKET; ++fir_idx)
     //{
     //	ROS_WARN("[%f %f %f]", firings[fir_idx].azimuth[0], firings[fir_idx].distance[0], firings[fir_idx].intensity[0]);
@@ -427,6 +1019,318 @@ void LslidarC16Decoder::decodePacket(const RawPacket* packet) {
     return;
 }
 
+template <typename Format>
+void LslidarC16Decoder::storeFirings(
+        size_t start_fir_idx, size_t end_fir_idx) {
+    for (size_t fir_idx = start_fir_idx; fir_idx < end_fir_idx; ++fir_idx) {
+        // Close the sector once a firing has moved past it.
+        if (sectors > 0) {
+            int sector = firings[fir_idx].firing_azimuth * sector_scale;
+            if (sector > sectors - 1) sector = sectors - 1;
+            if (sector > current_sector) {
+                publishSector();
+                current_sector = sector;
+            }
+        }
+
+        // Every return of the firing is stored, first returns first.
+        for (int ret = 0; ret < Format::RETURNS; ++ret) {
+            const int blk_fir_idx = Format::firing(fir_idx, ret);
+            for (size_t scan_idx = 0; scan_idx < SCANS_PER_FIRING; ++scan_idx) {
+                // Remap the index of the scan
+                int remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
+
+                // Check if the point is valid.
+                const uint16_t raw_distance =
+                        decoded_firings.raw_distance[blk_fir_idx][scan_idx];
+                // A second return equal to the first is the same echo.
+                if (ret > 0 && raw_distance ==
+                        decoded_firings.raw_distance[Format::firing(fir_idx, 0)][scan_idx])
+                    continue;
+                const int tick = azimuthTick(decoded_firings.azimuth[blk_fir_idx][scan_idx]);
+                if (!roi_mask.contains(remapped_scan_idx, raw_distance, tick)) continue;
+
+                // Compute the time of the point
+                double time = packet_start_time +
+                        FIRING_TOFFSET*(fir_idx-start_fir_idx) + DSR_TOFFSET*scan_idx;
+
+                long idx = decode_buffer->reserve(remapped_scan_idx);
+                if (idx < 0) continue;
+
+                // Pack the data into the sweep buffer
+                decode_buffer->time[idx] = time;
+                decode_buffer->x[idx] = decoded_firings.x[blk_fir_idx][scan_idx];
+                decode_buffer->y[idx] = decoded_firings.y[blk_fir_idx][scan_idx];
+                decode_buffer->z[idx] = decoded_firings.z[blk_fir_idx][scan_idx];
+                decode_buffer->azimuth[idx] = decoded_firings.azimuth[blk_fir_idx][scan_idx];
+                decode_buffer->distance[idx] = raw_distance;
+                decode_buffer->intensity[idx] = decoded_firings.intensity[blk_fir_idx][scan_idx];
+
+                // Drop the point into its scan bin right away.
+                if (scan_bins_active && remapped_scan_idx == scan_bin_layer) {
+                    int point_idx = static_cast<int>(
+                                decode_buffer->azimuth[idx] * scan_bin_scale + 0.5f);
+                    if (point_idx >= point_num)
+                        point_idx = 0;
+                    point_idx = point_num - 1 - point_idx;
+                    if (scan_bin_disabled[point_idx]) continue;
+
+                    layer_bins.ranges[point_idx] = raw_distance * DISTANCE_RESOLUTION;
+                    layer_bins.intensities[point_idx] = decode_buffer->intensity[idx];
+                    ++layer_bins.points;
+                }
+            }
+        }
+    }
+
+    packet_start_time += FIRING_TOFFSET * (end_fir_idx-start_fir_idx);
+    return;
+}
+
+bool LslidarC16Decoder::deskewSweep(ros::Time& target_time) {
+    if (!tf_listener) return false;
+
+    // Time span of the sweep [µs].
+    float first_time, last_time;
+    if (!sweepTimeSpan(first_time, last_time)) return false;
+
+    const ros::Time time_base = sweepTimeBase(last_time);
+    const ros::Time end_time = time_base + ros::Duration(last_time * 1e-6);
+    const float slice_duration = (last_time - first_time) / deskew_slices;
+
+    // One correction per slice, from the sensor pose in the middle of
+    // the slice to the pose at the end of the sweep.
+    try {
+        tf_listener->waitForTransform(deskew_fixed_frame, frame_id, end_time,
+                                      ros::Duration(deskew_timeout));
+        tf::StampedTransform end_pose;
+        tf_listener->lookupTransform(deskew_fixed_frame, frame_id, end_time, end_pose);
+        const tf::Transform end_inverse = end_pose.inverse();
+
+        for (int k = 0; k < deskew_slices; ++k) {
+            const ros::Time slice_time = time_base + ros::Duration(
+                        (first_time + (k + 0.5f) * slice_duration) * 1e-6);
+            tf::StampedTransform pose;
+            tf_listener->lookupTransform(deskew_fixed_frame, frame_id, slice_time, pose);
+            const tf::Transform correction = end_inverse * pose;
+
+            float* m = &deskew_transforms[k * 12];
+            const tf::Matrix3x3& basis = correction.getBasis();
+            const tf::Vector3& origin = correction.getOrigin();
+            for (int r = 0; r < 3; ++r) {
+                m[4*r + 0] = basis[r].x();
+                m[4*r + 1] = basis[r].y();
+                m[4*r + 2] = basis[r].z();
+            }
+            m[3] = origin.x();
+            m[7] = origin.y();
+            m[11] = origin.z();
+        }
+    } catch (tf::TransformException& e) {
+        ROS_WARN_THROTTLE(10, "Cannot de-skew the sweep: %s", e.what());
+        return false;
+    }
+
+    // Within a ring, the points of a slice are contiguous, so every run
+    // is a plain loop over x/y/z with one matrix.
+    const float inv_slice_duration = 1.0f / slice_duration;
+    float* x = &sweep_buffer.x[0];
+    float* y = &sweep_buffer.y[0];
+    float* z = &sweep_buffer.z[0];
+    const float* time = &sweep_buffer.time[0];
+
+    for (int i = 0; i < SWEEP_RINGS; ++i) {
+        size_t j = sweep_buffer.begin(i);
+        const size_t end = sweep_buffer.end(i);
+        while (j < end) {
+            int k = (time[j] - first_time) * inv_slice_duration;
+            if (k > deskew_slices - 1) k = deskew_slices - 1;
+            const float slice_end = first_time + (k + 1) * slice_duration;
+            size_t run_end = j + 1;
+            while (run_end < end && (time[run_end] < slice_end || k == deskew_slices - 1))
+                ++run_end;
+
+            const float* m = &deskew_transforms[k * 12];
+            for (size_t p = j; p < run_end; ++p) {
+                const float px = x[p];
+                const float py = y[p];
+                const float pz = z[p];
+                x[p] = m[0]*px + m[1]*py + m[2]*pz + m[3];
+                y[p] = m[4]*px + m[5]*py + m[6]*pz + m[7];
+                z[p] = m[8]*px + m[9]*py + m[10]*pz + m[11];
+            }
+            j = run_end;
+        }
+    }
+
+    target_time = end_time;
+    return true;
+}
+
+void LslidarC16Decoder::publishSector() {
+    if (!wanted(sector_pub)) {
+        for (int i = 0; i < SWEEP_RINGS; ++i)
+            sector_begin[i] = decode_buffer->size[i];
+        return;
+    }
+
+    // The times of the first and last point of the sector [µs].
+    float first_time = std::numeric_limits<float>::max();
+    float last_time = 0.0f;
+    size_t num_points = 0;
+    for (int i = 0; i < SWEEP_RINGS; ++i) {
+        if (decode_buffer->size[i] == sector_begin[i]) continue;
+        first_time = std::min(first_time,
+                decode_buffer->time[decode_buffer->begin(i) + sector_begin[i]]);
+        last_time = std::max(last_time, decode_buffer->time[decode_buffer->end(i) - 1]);
+        num_points += decode_buffer->size[i] - sector_begin[i];
+    }
+    if (num_points == 0) return;
+
+    // Stamp the chunk with its first point, the time field holds the
+    // offset of each point from it [s].
+    sensor_msgs::PointCloud2Ptr cloud(new sensor_msgs::PointCloud2());
+    cloud->header.frame_id = frame_id;
+    if (use_gps_ts)
+        cloud->header.stamp = ros::Time(sweep_start_time + first_time * 1e-6);
+    else
+        cloud->header.stamp = ros::Time::now() -
+                ros::Duration((last_time - first_time) * 1e-6);
+    initPointCloudFields(*cloud, CLOUD_XYZIT);
+    cloud->data.resize(num_points * SECTOR_POINT_STEP);
+
+    uint8_t* ptr = &cloud->data[0];
+    num_points = 0;
+    for (int i = 0; i < SWEEP_RINGS; ++i) {
+        const size_t end = decode_buffer->end(i);
+        for (size_t j = decode_buffer->begin(i) + sector_begin[i]; j < end; ++j) {
+            if (!inCloud(*decode_buffer, i, j)) continue;
+
+            float* fields = reinterpret_cast<float*>(ptr);
+            fields[0] = decode_buffer->x[j];
+            fields[1] = decode_buffer->y[j];
+            fields[2] = decode_buffer->z[j];
+            fields[3] = decode_buffer->intensity[j];
+            fields[4] = (decode_buffer->time[j] - first_time) * 1e-6f;
+            ptr += SECTOR_POINT_STEP;
+            ++num_points;
+        }
+        sector_begin[i] = decode_buffer->size[i];
+    }
+
+    cloud->data.resize(num_points * SECTOR_POINT_STEP);
+    cloud->width = num_points;
+    cloud->row_step = num_points * SECTOR_POINT_STEP;
+    if (sector_pub) sector_pub.publish(cloud);
+    return;
+}
+
+void LslidarC16Decoder::publishSweep() {
+    // A recycled sweep keeps the capacity of its point vectors, so
+    // resizing them does not allocate once the sweeps are similar.
+    lslidar_c16_msgs::LslidarC16SweepPtr sweep_data = sweep_pool.acquire();
+    sweep_data->header.frame_id = "sweep";
+    sweep_data->header.stamp = sweep_stamp;
+    sweep_data->completeness = sweep_completeness;
+    sweep_data->missing_packets = completed_missing_packets;
+
+    for (size_t scan_idx = 0; scan_idx < 16; ++scan_idx) {
+        size_t remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
+        lslidar_c16_msgs::LslidarC16Scan& scan =
+                sweep_data->scans[remapped_scan_idx];
+        scan.altitude = altitude[scan_idx];
+        scan.points.resize(sweep_buffer.size[remapped_scan_idx]);
+
+        size_t idx = sweep_buffer.begin(remapped_scan_idx);
+        for (size_t i = 0; i < scan.points.size(); ++i, ++idx) {
+            lslidar_c16_msgs::LslidarC16Point& point = scan.points[i];
+            point.time = sweep_buffer.time[idx];
+            point.x = sweep_buffer.x[idx];
+            point.y = sweep_buffer.y[idx];
+            point.z = sweep_buffer.z[idx];
+            point.azimuth = sweep_buffer.azimuth[idx];
+            point.distance = sweep_buffer.distance[idx] * DISTANCE_RESOLUTION;
+            point.intensity = sweep_buffer.intensity[idx];
+        }
+    }
+
+    sweep_pub.publish(sweep_data);
+    return;
+}
+
+void LslidarC16Decoder::publishCompactSweep() {
+    lslidar_c16_msgs::LslidarC16CompactSweepPtr sweep_data = compact_sweep_pool.acquire();
+    sweep_data->header.frame_id = frame_id;
+    sweep_data->header.stamp = sweep_stamp;
+
+    float first_time, last_time;
+    sweepTimeSpan(first_time, last_time);
+    sweep_data->time_base = sweepTimeBase(last_time);
+    sweep_data->firing_period = FIRING_TOFFSET;
+    sweep_data->distance_resolution = DISTANCE_RESOLUTION;
+    sweep_data->completeness = sweep_completeness;
+    sweep_data->missing_packets = completed_missing_packets;
+
+    for (size_t scan_idx = 0; scan_idx < 16; ++scan_idx) {
+        size_t remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
+        lslidar_c16_msgs::LslidarC16CompactScan& scan =
+                sweep_data->scans[remapped_scan_idx];
+        scan.altitude = altitude[scan_idx];
+        scan.azimuth_offset = azimuth_offset[scan_idx];
+        scan.time_offset = DSR_TOFFSET * scan_idx;
+
+        const size_t size = sweep_buffer.size[remapped_scan_idx];
+        scan.distance.resize(size);
+        scan.azimuth.resize(size);
+        scan.intensity.resize(size);
+        scan.firing.resize(size);
+
+        // The point times are time_offset plus whole firings.
+        size_t idx = sweep_buffer.begin(remapped_scan_idx);
+        for (size_t i = 0; i < size; ++i, ++idx) {
+            int tick = static_cast<int>(sweep_buffer.azimuth[idx] * AZIMUTH_TICKS_PER_RAD + 0.5f);
+            if (tick >= AZIMUTH_TICKS) tick -= AZIMUTH_TICKS;
+            scan.distance[i] = sweep_buffer.distance[idx];
+            scan.azimuth[i] = tick;
+            scan.intensity[i] = sweep_buffer.intensity[idx];
+            scan.firing[i] = static_cast<uint16_t>(
+                        (sweep_buffer.time[idx] - scan.time_offset) / FIRING_TOFFSET + 0.5f);
+        }
+    }
+
+    compact_sweep_pub.publish(sweep_data);
+    return;
+}
+
+void LslidarC16Decoder::resetScanBins(ScanBins& bins) {
+    bins.ranges.assign(point_num, std::numeric_limits<float>::infinity());
+    bins.intensities.assign(point_num, std::numeric_limits<float>::infinity());
+    bins.points = 0;
+    return;
+}
+
+void LslidarC16Decoder::publishIncrementalScan() {
+    ROS_INFO_ONCE("default channel is %d", scan_layer);
+    if (output_bins.points > 1 && wanted(scan_pub)) {
+        sensor_msgs::LaserScan::Ptr scan = scan_pool.acquire();
+        scan->header.frame_id = frame_id;
+        scan->header.stamp = sweep_stamp;
+
+        scan->angle_min = 0.0;
+        scan->angle_max = 2.0*M_PI;
+        scan->angle_increment = (scan->angle_max - scan->angle_min)/point_num;
+        scan->range_min = min_range;
+        scan->range_max = max_range;
+
+        // The bins are complete, hand them over instead of copying.
+        // The bins get the vectors of the recycled message back.
+        scan->ranges.swap(output_bins.ranges);
+        scan->intensities.swap(output_bins.intensities);
+        if (scan_pub) scan_pub.publish(scan);
+    }
+    return;
+}
+
 void LslidarC16Decoder::layerCallback(const std_msgs::Int8Ptr& msg){
     int num = msg->data;
     if (num < 0)
@@ -440,207 +1344,348 @@ void LslidarC16Decoder::layerCallback(const std_msgs::Int8Ptr& msg){
         ROS_WARN("layer num outside of the index, select layer 15 instead!");
     }
     ROS_INFO("select layer num: %d", msg->data);
-    layer_num = num;
+    layer_num.store(num, std::memory_order_relaxed);
     return;
 }
 
 void LslidarC16Decoder::packetCallback(
         const lslidar_c16_msgs::LslidarC16PacketConstPtr& msg) {
     //  ROS_WARN("packetCallBack");
-    // Convert the msg to the raw packet type.
-    const RawPacket* raw_packet = (const RawPacket*) (&(msg->data[0]));
+    processPacket(&(msg->data[0]), msg->stamp);
+    return;
+}
 
-    // Check if the packet is valid
-    if (!checkPacketValidity(raw_packet)) return;
+// Valid packets detectFormat() looks at before it picks a layout.
+static const int DETECT_PACKETS = 8;
 
-    // Decode the packet
-    decodePacket(raw_packet);
+void LslidarC16Decoder::detectFormat(
+        const uint8_t* data, const ros::Time& stamp) {
+    // Both layouts share the block header.
+    const RawPacket* raw_packet = (const RawPacket*) data;
+    if (!checkPacketValidity<SingleReturnFormat>(raw_packet)) return;
 
-    // Find the start of a new revolution
-    //    If there is one, new_sweep_start will be the index of the start firing,
-    //    otherwise, new_sweep_start will be FIRINGS_PER_PACKET.
-    size_t new_sweep_start = 0;
-    do {
-        //    if (firings[new_sweep_start].firing_azimuth < last_azimuth) break;
-        if (fabs(firings[new_sweep_start].firing_azimuth - last_azimuth) > M_PI) break;
-        else {
-            last_azimuth = firings[new_sweep_start].firing_azimuth;
-            ++new_sweep_start;
-        }
-    } while (new_sweep_start < FIRINGS_PER_PACKET);
-    //  ROS_WARN("new_sweep_start %d", new_sweep_start);
+    // Only the dual return mode repeats the azimuth of a block. A
+    // stopped motor does as well, so the layout goes by the majority
+    // of several packets, which are dropped meanwhile.
+    detect_paired += pairedBlocks(raw_packet);
+    if (++detect_packets < DETECT_PACKETS) return;
 
-    // The first sweep may not be complete. So, the firings with
-    // the first sweep will be discarded. We will wait for the
-    // second sweep in order to find the 0 azimuth angle.
-    size_t start_fir_idx = 0;
-    size_t end_fir_idx = new_sweep_start;
-    if (is_first_sweep &&
-            new_sweep_start == FIRINGS_PER_PACKET) {
-        // The first sweep has not ended yet.
-        return;
+    if (2*detect_paired > detect_packets) {
+        packet_handler = &LslidarC16Decoder::processFormat<DualReturnFormat>;
+        ROS_INFO("Detected %s packets", DualReturnFormat::name());
     } else {
-        if (is_first_sweep) {
-            is_first_sweep = false;
-            start_fir_idx = new_sweep_start;
-            end_fir_idx = FIRINGS_PER_PACKET;
-            sweep_start_time = msg->stamp.toSec() +
-                    FIRING_TOFFSET * (end_fir_idx-start_fir_idx) * 1e-6;
-        }
+        packet_handler = &LslidarC16Decoder::processFormat<SingleReturnFormat>;
+        ROS_INFO("Detected %s packets", SingleReturnFormat::name());
     }
+    detect_packets = 0;
+    detect_paired = 0;
+    format_mismatches = 0;
+    processPacket(data, stamp);
+    return;
+}
 
-    for (size_t fir_idx = start_fir_idx; fir_idx < end_fir_idx; ++fir_idx) {
-        for (size_t scan_idx = 0; scan_idx < SCANS_PER_FIRING; ++scan_idx) {
-            // Check if the point is valid.
-            if (!isPointInRange(firings[fir_idx].distance[scan_idx])) continue;
-
-            // Convert the point to xyz coordinate
-            size_t table_idx = floor(firings[fir_idx].azimuth[scan_idx]*1000.0+0.5);
-            //cout << table_idx << endl;
-            double cos_azimuth = cos_azimuth_table[table_idx];
-            double sin_azimuth = sin_azimuth_table[table_idx];
-
-            //double x = firings[fir_idx].distance[scan_idx] *
-            //  cos_scan_altitude[scan_idx] * sin(firings[fir_idx].azimuth[scan_idx]);
-            //double y = firings[fir_idx].distance[scan_idx] *
-            //  cos_scan_altitude[scan_idx] * cos(firings[fir_idx].azimuth[scan_idx]);
-            //double z = firings[fir_idx].distance[scan_idx] *
-            //  sin_scan_altitude[scan_idx];
-
-            double x = firings[fir_idx].distance[scan_idx] *
-                    cos_scan_altitude[scan_idx] * sin_azimuth;
-            double y = firings[fir_idx].distance[scan_idx] *
-                    cos_scan_altitude[scan_idx] * cos_azimuth;
-            double z = firings[fir_idx].distance[scan_idx] *
-                    sin_scan_altitude[scan_idx];
-
-            double x_coord = y;
-            double y_coord = -x;
-            double z_coord = z;
-
-            // Compute the time of the point
-            double time = packet_start_time +
-                    FIRING_TOFFSET*fir_idx + DSR_TOFFSET*scan_idx;
-
-            // Remap the index of the scan
-            int remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
-            sweep_data->scans[remapped_scan_idx].points.push_back(
-                        lslidar_c16_msgs::LslidarC16Point());
-
-            lslidar_c16_msgs::LslidarC16Point& new_point =		// new_point 为push_back最后一个的引用
-                    sweep_data->scans[remapped_scan_idx].points[
-                    sweep_data->scans[remapped_scan_idx].points.size()-1];
-
-            // Pack the data into point msg
-            new_point.time = time;
-            new_point.x = x_coord;
-            new_point.y = y_coord;
-            new_point.z = z_coord;
-            new_point.azimuth = firings[fir_idx].azimuth[scan_idx];
-            new_point.distance = firings[fir_idx].distance[scan_idx];
-            new_point.intensity = firings[fir_idx].intensity[scan_idx];
+// Backward azimuth steps up to this size are jitter, not the start of
+// a new revolution [rad].
+static const double AZIMUTH_JITTER = 1.0 * DEG_TO_RAD;
+
+template <typename Format>
+void LslidarC16Decoder::checkContinuity(const ros::Time& stamp) {
+    static const size_t FIRINGS = Format::FIRINGS;
+
+    // The azimuth step of one firing, measured on this packet.
+    double step = firings[FIRINGS-1].firing_azimuth - firings[0].firing_azimuth;
+    step = step < 0 ? step + 2*M_PI : step;
+    step /= FIRINGS - 1;
+    const double packet_span = step * FIRINGS;
+
+    // After more than a revolution without packets, the azimuth does
+    // not tell what was lost. Close the sweep and start a new one at
+    // this packet, as well when the stamps go back, e.g. in a replay
+    // starting over.
+    const double packet_gap = (stamp - last_packet_stamp).toSec();
+    if (packet_gap < 0.0 || packet_gap > 1.5 / frequency) {
+        if (packet_gap > 0.0 && packet_span > 0.0) {
+            const double lost = packet_gap * frequency * 2*M_PI / packet_span - 1.0;
+            if (lost >= 0.5) {
+                const uint32_t packets = static_cast<uint32_t>(lost + 0.5);
+                missing_packets.fetch_add(packets, std::memory_order_relaxed);
+                missing_degrees.fetch_add(static_cast<uint64_t>(
+                        packets * packet_span * RAD_TO_DEG + 0.5), std::memory_order_relaxed);
+                sweep_missing_packets += packets;
+            }
         }
+        ROS_WARN_THROTTLE(10, "No packet for %.3f s, starting a new sweep", packet_gap);
+        sweep_gap += 2*M_PI - last_azimuth;
+        finishSweep();
+        startSweep(stamp);
+        return;
     }
 
-    packet_start_time += FIRING_TOFFSET * (end_fir_idx-start_fir_idx);
+    // The first firing should follow the last one of the previous
+    // packet by one step. Less than half a packet more is jitter.
+    double delta = firings[0].firing_azimuth - last_azimuth;
+    const bool wrapped = delta < -AZIMUTH_JITTER;
+    delta = wrapped ? delta + 2*M_PI : delta;
+    const double missing = delta - step;
+    if (packet_span <= 0.0 || missing < packet_span / 2) return;
+
+    const uint32_t packets = std::max<uint32_t>(1, missing / packet_span + 0.5);
+    missing_packets.fetch_add(packets, std::memory_order_relaxed);
+    missing_degrees.fetch_add(static_cast<uint64_t>(missing * RAD_TO_DEG + 0.5),
+                              std::memory_order_relaxed);
+
+    // The part of the gap past the wrap belongs to the next sweep.
+    const double current = wrapped ? std::min(missing, 2*M_PI - last_azimuth) : missing;
+    const uint32_t current_packets = static_cast<uint32_t>(packets * current / missing + 0.5);
+    sweep_gap += current;
+    sweep_missing_packets += current_packets;
+    next_sweep_gap += missing - current;
+    next_sweep_missing_packets += packets - current_packets;
+
+    // Keep the point times of the sweep in step with the rotation.
+    packet_start_time += FIRING_TOFFSET * current / step;
+    return;
+}
 
-    // A new sweep begins
-    if (end_fir_idx != FIRINGS_PER_PACKET) {
-        //	ROS_WARN("A new sweep begins");
-        // Publish the last revolution
-        sweep_data->header.frame_id = "sweep";
+void LslidarC16Decoder::startSweep(const ros::Time& stamp) {
+    // A sweep starting in the middle of a revolution lacks the
+    // azimuths before its first firing.
+    is_first_sweep = false;
+    sweep_gap = firings[0].firing_azimuth;
+    sweep_missing_packets = 0;
+    next_sweep_gap = 0.0;
+    next_sweep_missing_packets = 0;
+    sweep_start_time = stamp.toSec();
+    packet_start_time = 0.0;
+    last_azimuth = firings[0].firing_azimuth;
+    return;
+}
 
-        if (use_gps_ts){
-            sweep_data->header.stamp = ros::Time(sweep_start_time);
+void LslidarC16Decoder::finishSweep() {
+    const double completeness = std::max(0.0, 1.0 - sweep_gap / (2*M_PI));
+    sweep_coverage.add(static_cast<uint64_t>(completeness * 100.0 + 0.5));
+
+    // Publish the last revolution
+    ros::Time stamp;
+    if (use_gps_ts){
+        stamp = ros::Time(sweep_start_time);
+    }
+    else{
+        stamp = ros::Time::now();
+    }
+
+    // The last sector closes with the sweep.
+    if (sectors > 0) {
+        publishSector();
+        current_sector = 0;
+        for (int i = 0; i < SWEEP_RINGS; ++i)
+            sector_begin[i] = 0;
+    }
+
+    ++sweep_count;
+    point_count += decode_buffer->totalSize();
+    sweep_points.add(decode_buffer->totalSize());
+    if (last_sweep_start_time > 0.0) {
+        const double period = sweep_start_time - last_sweep_start_time;
+        if (period > 0.0) {
+            sweep_period.add(period * 1e6);
+            sweep_jitter.add(fabs(period - 1.0/frequency) * 1e6);
         }
-        else{
-            sweep_data->header.stamp = ros::Time::now();
+    }
+    last_sweep_start_time = sweep_start_time;
+
+    if (decode_buffer->dropped > 0)
+        ROS_WARN_THROTTLE(10, "sweep buffer full, %lu points dropped",
+                          decode_buffer->dropped);
+
+    if (completeness < min_sweep_completeness) {
+        // Too many packets are missing, nothing but the sectors is
+        // published for this sweep.
+        skipped_sweeps.fetch_add(1, std::memory_order_relaxed);
+    } else if (!two_stage) {
+        sweep_stamp = stamp;
+        sweep_completeness = completeness;
+        completed_missing_packets = sweep_missing_packets;
+        scan_layer = layer_num.load(std::memory_order_relaxed);
+        std::swap(layer_bins, output_bins);
+        publishOutputs();
+    } else {
+        // Hand the sweep to the output thread, which still works on
+        // the previous one if it took longer than a whole sweep.
+        boost::mutex::scoped_lock lock(output_mutex);
+        if (output_pending) {
+            output_overruns.fetch_add(1, std::memory_order_relaxed);
+            ROS_WARN_THROTTLE(10, "sweep outputs slower than the sensor, sweep dropped");
+        } else {
+            sweep_stamp = stamp;
+            sweep_completeness = completeness;
+            completed_missing_packets = sweep_missing_packets;
+            scan_layer = layer_num.load(std::memory_order_relaxed);
+            std::swap(layer_bins, output_bins);
+            sweep_buffer.swap(pipeline_buffer);
+            output_pending = true;
+            output_cond.notify_one();
         }
+    }
+    decode_buffer->clear();
 
+    // Bin the next sweep only while the scan has subscribers.
+    if (publish_scan && incremental_scan) {
+        scan_bin_layer = layer_num.load(std::memory_order_relaxed);
+        scan_bins_active = wanted(scan_pub);
+        resetScanBins(layer_bins);
+    }
 
-        sweep_pub.publish(sweep_data);
-
-        if (publish_point_cloud){
-			publishPointCloud();
-		}
-        if (publish_scan){
-			publishScan();
-           // publishChannelScan();
-		}
-       // else{
-        //    publishScan();
-       // }
+    // The gap past the wrap is already known.
+    sweep_gap = next_sweep_gap;
+    sweep_missing_packets = next_sweep_missing_packets;
+    next_sweep_gap = 0.0;
+    next_sweep_missing_packets = 0;
+    return;
+}
 
-        sweep_data = lslidar_c16_msgs::LslidarC16SweepPtr(
-                    new lslidar_c16_msgs::LslidarC16Sweep());
+/** @brief Build every wanted output of the completed sweep.
+ *
+ *  Reads sweep_buffer and the sweep_* state of the completed sweep,
+ *  on the decoding thread or, with two_stage, on the output thread.
+ */
+void LslidarC16Decoder::publishOutputs() {
+    const uint64_t sweep_output_start = lslidar_c16_driver::monotonicNs();
+
+    // Only build the outputs somebody listens to. They all read the
+    // same sweep buffer.
+    const bool want_cloud = publish_point_cloud && wanted(point_cloud_pub);
+    const bool want_organized = (organized_cloud && wanted(organized_cloud_pub)) ||
+            (range_image && (wanted(range_image_pub) || wanted(intensity_image_pub)));
+    const bool want_scan = publish_scan && wanted(scan_pub);
+    // scan_channel has no parameter, it is only built on demand.
+    const bool want_channels = channel_scan_pub.getNumSubscribers() > 0;
+    const bool want_merge = merge_callback && merge_pub.getNumSubscribers() > 0;
+
+    if (wanted(sweep_pub))
+        publishSweep();
+    if (wanted(compact_sweep_pub))
+        publishCompactSweep();
+
+    // The clouds below use the de-skewed points, stamped with the
+    // time they were corrected to.
+    cloud_stamp = sweep_stamp;
+    if (deskew && (want_cloud || want_organized || want_merge))
+        deskewSweep(cloud_stamp);
+
+    if (want_cloud)
+        publishPointCloud();
+    if (want_organized)
+        publishOrganized();
+    if (want_merge) {
+        float first_time, last_time;
+        sweepTimeSpan(first_time, last_time);
+        merge_callback(*this, sweepTimeBase(last_time));
+    }
 
-        // Prepare the next revolution
-        sweep_start_time = msg->stamp.toSec() +
-                FIRING_TOFFSET * (end_fir_idx-start_fir_idx) * 1e-6;
+    // The binned channel scans include the selected layer, so it
+    // is taken from there unless it is binned incrementally.
+    if (publish_scan && incremental_scan)
+        publishIncrementalScan();
+    if (want_channels)
+        publishChannelScan(want_scan && !incremental_scan);
+    else if (want_scan && !incremental_scan)
+        publishScan();
 
-        packet_start_time = 0.0;
-        last_azimuth = firings[FIRINGS_PER_PACKET-1].firing_azimuth;
+    sweep_time.add((lslidar_c16_driver::monotonicNs() - sweep_output_start) / 1000);
+    return;
+}
 
-        start_fir_idx = end_fir_idx;
-        end_fir_idx = FIRINGS_PER_PACKET;
+/** @brief Output thread main loop, with two_stage. */
+void LslidarC16Decoder::outputLoop() {
+    boost::mutex::scoped_lock lock(output_mutex);
+    while (true) {
+        while (output_running && !output_pending)
+            output_cond.wait(lock);
+        if (!output_running)
+            break;
+
+        // The decoding thread leaves the completed sweep alone until
+        // output_pending is cleared.
+        lock.unlock();
+        publishOutputs();
+        lock.lock();
+        output_pending = false;
+    }
+    return;
+}
 
-        for (size_t fir_idx = start_fir_idx; fir_idx < end_fir_idx; ++fir_idx) {
-            for (size_t scan_idx = 0; scan_idx < SCANS_PER_FIRING; ++scan_idx) {
-                // Check if the point is valid.
-                if (!isPointInRange(firings[fir_idx].distance[scan_idx])) continue;
-
-                // Convert the point to xyz coordinate
-                size_t table_idx = floor(firings[fir_idx].azimuth[scan_idx]*1000.0+0.5);
-                //cout << table_idx << endl;
-                double cos_azimuth = cos_azimuth_table[table_idx];
-                double sin_azimuth = sin_azimuth_table[table_idx];
-
-                //double x = firings[fir_idx].distance[scan_idx] *
-                //  cos_scan_altitude[scan_idx] * sin(firings[fir_idx].azimuth[scan_idx]);
-                //double y = firings[fir_idx].distance[scan_idx] *
-                //  cos_scan_altitude[scan_idx] * cos(firings[fir_idx].azimuth[scan_idx]);
-                //double z = firings[fir_idx].distance[scan_idx] *
-                //  sin_scan_altitude[scan_idx];
-
-                double x = firings[fir_idx].distance[scan_idx] *
-                        cos_scan_altitude[scan_idx] * sin_azimuth;
-                double y = firings[fir_idx].distance[scan_idx] *
-                        cos_scan_altitude[scan_idx] * cos_azimuth;
-                double z = firings[fir_idx].distance[scan_idx] *
-                        sin_scan_altitude[scan_idx];
-
-                double x_coord = y;
-                double y_coord = -x;
-                double z_coord = z;
+template <typename Format>
+void LslidarC16Decoder::processFormat(
+        const uint8_t* data, const ros::Time& stamp) {
+    static const size_t FIRINGS = Format::FIRINGS;
 
-                // Compute the time of the point
-                double time = packet_start_time +
-                        FIRING_TOFFSET*(fir_idx-start_fir_idx) + DSR_TOFFSET*scan_idx;
+    // Convert the buffer to the raw packet type.
+    const RawPacket* raw_packet = (const RawPacket*) data;
 
-                // Remap the index of the scan
-                int remapped_scan_idx = scan_idx%2 == 0 ? scan_idx/2 : scan_idx/2+8;
-                sweep_data->scans[remapped_scan_idx].points.push_back(
-                            lslidar_c16_msgs::LslidarC16Point());
-                lslidar_c16_msgs::LslidarC16Point& new_point =
-                        sweep_data->scans[remapped_scan_idx].points[
-                        sweep_data->scans[remapped_scan_idx].points.size()-1];
-
-                // Pack the data into point msg
-                new_point.time = time;
-                new_point.x = x_coord;
-                new_point.y = y_coord;
-                new_point.z = z_coord;
-                new_point.azimuth = firings[fir_idx].azimuth[scan_idx];
-                new_point.distance = firings[fir_idx].distance[scan_idx];
-                new_point.intensity = firings[fir_idx].intensity[scan_idx];
+    // Check if the packet is valid
+    if (!checkPacketValidity<Format>(raw_packet)) return;
+
+    // The sensor may be switched to another return mode while it
+    // runs. Packets that do not fit the layout are dropped, and once
+    // too many of them come in a row the layout is detected again.
+    if (auto_format) {
+        if (pairedBlocks(raw_packet) != Format::PAIRED_BLOCKS) {
+            if (++format_mismatches >= DETECT_PACKETS) {
+                ROS_WARN("Packets no longer fit the %s layout, detecting it again",
+                         Format::name());
+                packet_handler = &LslidarC16Decoder::detectFormat;
             }
+            return;
         }
+        format_mismatches = 0;
+    }
 
-        packet_start_time += FIRING_TOFFSET * (end_fir_idx-start_fir_idx);
+    // Decode the packet
+    decodePacket<Format>(raw_packet);
+
+    // The first sweep starts with the first packet, wherever the
+    // sensor points, and is published as a partial sweep. Later
+    // packets are checked for the ones lost in between.
+    if (is_first_sweep)
+        startSweep(stamp);
+    else
+        checkContinuity<Format>(stamp);
+    last_packet_stamp = stamp;
+
+    // Find the start of a new revolution
+    //    If there is one, new_sweep_start will be the index of the start firing,
+    //    otherwise, new_sweep_start will be FIRINGS. The azimuth only
+    //    goes back at the wrap, lost packets may move it ahead by any
+    //    amount.
+    size_t new_sweep_start = 0;
+    do {
+        if (firings[new_sweep_start].firing_azimuth < last_azimuth - AZIMUTH_JITTER) break;
+        else {
+            last_azimuth = firings[new_sweep_start].firing_azimuth;
+            ++new_sweep_start;
+        }
+    } while (new_sweep_start < FIRINGS);
+    //  ROS_WARN("new_sweep_start %d", new_sweep_start);
+
+    storeFirings<Format>(0, new_sweep_start);
+
+    // A new sweep begins
+    if (new_sweep_start != FIRINGS) {
+        //	ROS_WARN("A new sweep begins");
+        finishSweep();
+
+        // Prepare the next revolution
+        sweep_start_time = stamp.toSec() +
+                FIRING_TOFFSET * new_sweep_start * 1e-6;
+
+        packet_start_time = 0.0;
+        last_azimuth = firings[FIRINGS-1].firing_azimuth;
+
+        storeFirings<Format>(new_sweep_start, FIRINGS);
     }
     //  ROS_WARN("pack end");
     return;
 }
 
 } // end namespace lslidar_c16_decoder
-
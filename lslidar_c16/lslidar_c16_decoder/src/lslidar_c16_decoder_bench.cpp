@@ -0,0 +1,275 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Offline decoder benchmark.
+ *
+ *   rosrun lslidar_c16_decoder lslidar_c16_decoder_bench capture [repeat]
+ *
+ * The capture is a pcap file, a capture file written with the driver's
+ * record_file, or a raw dump of back-to-back 1206-byte packets. All
+ * packets are loaded first, then fed through processPacket() `repeat`
+ * times. Nothing is published, the decoder parameters are read from
+ * the private namespace as usual. Every SIMD decode kernel the CPU
+ * supports is checked against the scalar one, the bench exits with 1
+ * when their returns differ.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+
+#include <lslidar_c16_driver/input.h>
+#include <lslidar_c16_decoder/decode_kernels.h>
+#include <lslidar_c16_decoder/lslidar_c16_decoder.h>
+
+using namespace lslidar_c16_decoder;
+
+// Count every heap allocation of the process.
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    ++allocations;
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == NULL) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+struct Capture {
+    std::vector<uint8_t> data;      ///< PACKET_SIZE bytes per packet
+    std::vector<ros::Time> stamps;
+
+    size_t size() const { return stamps.size(); }
+    const uint8_t* packet(size_t i) const { return &data[i * PACKET_SIZE]; }
+
+    void add(const uint8_t* packet, const ros::Time& stamp) {
+        data.insert(data.end(), packet, packet + PACKET_SIZE);
+        stamps.push_back(stamp);
+    }
+};
+
+static bool loadCapture(const std::string& path, Capture& capture) {
+    if (lslidar_c16_driver::detectInputFile(path) !=
+            lslidar_c16_driver::INPUT_FILE_UNKNOWN) {
+        lslidar_c16_driver::InputPtr input =
+                lslidar_c16_driver::openInputFile(path, 0.0, false);
+        if (!input) return false;
+
+        const uint8_t* data;
+        ros::Time stamp;
+        while (input->getPacket(data, stamp) == 0)
+            capture.add(data, stamp);
+    } else {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == NULL) {
+            ROS_ERROR("Cannot open %s", path.c_str());
+            return false;
+        }
+
+        // A raw dump, stamp the packets at the C16 packet rate.
+        std::vector<uint8_t> packet(PACKET_SIZE);
+        const double packet_period = FIRINGS_PER_PACKET * FIRING_TOFFSET * 1e-6;
+        while (fread(&packet[0], 1, PACKET_SIZE, file) == PACKET_SIZE)
+            capture.add(&packet[0], ros::Time(1.0 + capture.size() * packet_period));
+        fclose(file);
+    }
+
+    if (capture.size() == 0) {
+        ROS_ERROR("No lslidar packets in %s", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Tables and azimuths shared by the kernel timing and check.
+struct KernelInput {
+    float cos_azimuth[AZIMUTH_TABLE_SIZE];
+    float sin_azimuth[AZIMUTH_TABLE_SIZE];
+    float cos_altitude[16];
+    float sin_altitude[16];
+    int32_t azimuth_offset[16];
+    DecodeInput input;
+
+    KernelInput() {
+        fillAzimuthTables(cos_azimuth, sin_azimuth);
+        for (int i = 0; i < 16; ++i) {
+            cos_altitude[i] = cos_scan_altitude[i];
+            sin_altitude[i] = sin_scan_altitude[i];
+            azimuth_offset[i] = azimuthTableOffset(0.0);
+        }
+        input.cos_azimuth = cos_azimuth;
+        input.sin_azimuth = sin_azimuth;
+        input.azimuth_offset = azimuth_offset;
+        input.cos_altitude = cos_altitude;
+        input.sin_altitude = sin_altitude;
+        input.distance_resolution = DISTANCE_RESOLUTION;
+        for (int i = 0; i < KERNEL_FIRINGS; ++i) {
+            input.firing_azimuth[i] = i * 0.0035f;
+            input.azimuth_step[i] = 0.0035f / 32;
+        }
+    }
+};
+
+static const DecodeKernelType KERNEL_TYPES[] = {KERNEL_SCALAR, KERNEL_AVX2, KERNEL_NEON};
+static const size_t KERNEL_TYPE_COUNT = sizeof(KERNEL_TYPES) / sizeof(KERNEL_TYPES[0]);
+
+static bool sameFloat(float a, float b) {
+    return fabs(a - b) <= 1e-4f + 1e-6f * fabs(b);
+}
+
+// Decode the first packets of the capture with every SIMD kernel the
+// CPU supports and compare the returns with the scalar kernel.
+static bool checkKernels(const Capture& capture, KernelInput& kernel_input) {
+    DecodeInput& input = kernel_input.input;
+    static DecodedFirings expected;
+    static DecodedFirings output;
+    const size_t packets = std::min<size_t>(capture.size(), 4096);
+    DecodeKernel scalar = getDecodeKernel(KERNEL_SCALAR);
+    bool same = true;
+
+    for (size_t t = 1; t < KERNEL_TYPE_COUNT; ++t) {
+        DecodeKernel kernel = getDecodeKernel(KERNEL_TYPES[t]);
+        if (kernel == NULL) continue;
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < packets; ++i) {
+            input.packet = capture.packet(i);
+            scalar(input, expected);
+            kernel(input, output);
+            for (int f = 0; f < KERNEL_FIRINGS; ++f)
+                for (int c = 0; c < KERNEL_CHANNELS; ++c) {
+                    if (sameFloat(output.x[f][c], expected.x[f][c]) &&
+                            sameFloat(output.y[f][c], expected.y[f][c]) &&
+                            sameFloat(output.z[f][c], expected.z[f][c]) &&
+                            sameFloat(output.azimuth[f][c], expected.azimuth[f][c]) &&
+                            output.raw_distance[f][c] == expected.raw_distance[f][c] &&
+                            output.intensity[f][c] == expected.intensity[f][c])
+                        continue;
+                    if (mismatches++ == 0)
+                        fprintf(stderr, "kernel %s differs from scalar in packet %lu, "
+                                "firing %d, channel %d\n", decodeKernelName(KERNEL_TYPES[t]),
+                                (unsigned long)i, f, c);
+                }
+        }
+        if (mismatches > 0) {
+            fprintf(stderr, "kernel %s: %lu returns differ from scalar\n",
+                    decodeKernelName(KERNEL_TYPES[t]), (unsigned long)mismatches);
+            same = false;
+        }
+    }
+    return same;
+}
+
+// Time the packet kernels alone on the first packets of the capture.
+static void benchKernels(const Capture& capture, KernelInput& kernel_input) {
+    DecodeInput& input = kernel_input.input;
+    static DecodedFirings output;
+    const size_t packets = std::min<size_t>(capture.size(), 4096);
+    const size_t rounds = 1000000 / packets + 1;
+
+    for (size_t t = 0; t < KERNEL_TYPE_COUNT; ++t) {
+        DecodeKernel kernel = getDecodeKernel(KERNEL_TYPES[t]);
+        if (kernel == NULL) continue;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r)
+            for (size_t i = 0; i < packets; ++i) {
+                input.packet = capture.packet(i);
+                kernel(input, output);
+            }
+        const double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start).count();
+        printf("kernel %-6s  %8.1f ns/packet\n",
+               decodeKernelName(KERNEL_TYPES[t]), ns / (rounds * packets));
+    }
+}
+
+int main(int argc, char** argv) {
+    ros::init(argc, argv, "lslidar_c16_decoder_bench",
+              ros::init_options::AnonymousName);
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s capture.{pcap,lsc,bin} [repeat]\n", argv[0]);
+        return -1;
+    }
+    const int repeat = argc > 2 ? atoi(argv[2]) : 1;
+
+    Capture capture;
+    if (!loadCapture(argv[1], capture)) return -1;
+
+    ros::NodeHandle nh;
+    ros::NodeHandle pnh("~");
+    LslidarC16DecoderPtr decoder(new LslidarC16Decoder(nh, pnh));
+    if (!decoder->initialize(LslidarC16Decoder::OFFLINE)) {
+        ROS_ERROR("Cannot initialize the decoder...");
+        return -1;
+    }
+
+    // One untimed pass to warm up the caches and skip the first sweep.
+    for (size_t i = 0; i < capture.size(); ++i)
+        decoder->processPacket(capture.packet(i), capture.stamps[i]);
+
+    const uint64_t sweeps_before = decoder->getSweepCount();
+    const uint64_t points_before = decoder->getPointCount();
+    const uint64_t allocations_before = allocations;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int r = 0; r < repeat; ++r)
+        for (size_t i = 0; i < capture.size(); ++i)
+            decoder->processPacket(capture.packet(i), capture.stamps[i]);
+
+    const double seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+    const uint64_t packets = static_cast<uint64_t>(repeat) * capture.size();
+    const uint64_t sweeps = decoder->getSweepCount() - sweeps_before;
+    const uint64_t points = decoder->getPointCount() - points_before;
+    const uint64_t allocs = allocations - allocations_before;
+
+    printf("packets         %10lu\n", (unsigned long)packets);
+    printf("sweeps          %10lu\n", (unsigned long)sweeps);
+    printf("packets/s       %10.0f\n", packets / seconds);
+    printf("points/s        %10.0f\n", points / seconds);
+    printf("ns/packet       %10.1f\n", seconds * 1e9 / packets);
+    printf("allocs/sweep    %10.1f\n", sweeps > 0 ? double(allocs) / sweeps : 0.0);
+
+    // The kernel input is too large for the stack.
+    boost::shared_ptr<KernelInput> kernel_input(new KernelInput());
+    if (!checkKernels(capture, *kernel_input))
+        return 1;
+    benchKernels(capture, *kernel_input);
+    return 0;
+}
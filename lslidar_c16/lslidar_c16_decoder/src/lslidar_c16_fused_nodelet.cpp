@@ -0,0 +1,89 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include <lslidar_c16_decoder/lslidar_c16_fused_nodelet.h>
+
+namespace lslidar_c16_decoder {
+
+LslidarC16FusedNodelet::LslidarC16FusedNodelet():
+  running(false),
+  publish_packets(false) {
+  return;
+}
+
+LslidarC16FusedNodelet::~LslidarC16FusedNodelet() {
+  if (running) {
+    NODELET_INFO("shutting down driver thread");
+    running = false;
+    device_thread->join();
+    NODELET_INFO("driver thread stopped");
+  }
+  return;
+}
+
+void LslidarC16FusedNodelet::onInit() {
+  getPrivateNodeHandle().param<bool>("publish_packets", publish_packets, false);
+
+  driver.reset(new lslidar_c16_driver::LslidarC16Driver(
+        getNodeHandle(), getPrivateNodeHandle()));
+  if (!driver->initialize()) {
+    ROS_ERROR("Cannot initialize lslidar driver...");
+    return;
+  }
+
+  decoder.reset(new LslidarC16Decoder(
+        getNodeHandle(), getPrivateNodeHandle()));
+  if (!decoder->initialize(LslidarC16Decoder::DIRECT_PACKETS)) {
+    ROS_ERROR("Cannot initialize the lslidar puck decoder...");
+    return;
+  }
+
+  // spawn device poll thread
+  running = true;
+  device_thread = boost::shared_ptr< boost::thread >
+    (new boost::thread(boost::bind(&LslidarC16FusedNodelet::devicePoll, this)));
+}
+
+/** @brief Device poll thread main loop. */
+void LslidarC16FusedNodelet::devicePoll() {
+  const uint8_t* data;
+  ros::Time stamp;
+  while(ros::ok() && running) {
+    if (!driver->receiveRawPacket(data, stamp))
+      break;
+
+    decoder->processPacket(data, stamp);
+
+    // The raw packet topic is an optional side output.
+    if (publish_packets && driver->getNumPacketSubscribers() > 0) {
+      lslidar_c16_msgs::LslidarC16PacketPtr packet = driver->allocatePacket();
+      memcpy(&packet->data[0], data, packet->data.size());
+      packet->stamp = stamp;
+      driver->publishPacket(packet);
+    } else {
+      driver->tickDiagnostics(stamp);
+    }
+  }
+  running = false;
+}
+
+} // end namespace lslidar_c16_decoder
+
+PLUGINLIB_DECLARE_CLASS(lslidar_c16_decoder, LslidarC16FusedNodelet,
+    lslidar_c16_decoder::LslidarC16FusedNodelet, nodelet::Nodelet);
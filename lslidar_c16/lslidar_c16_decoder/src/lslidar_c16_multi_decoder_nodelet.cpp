@@ -0,0 +1,222 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <lslidar_c16_decoder/lslidar_c16_multi_decoder_nodelet.h>
+
+namespace lslidar_c16_decoder {
+
+LslidarC16MultiDecoderNodelet::LslidarC16MultiDecoderNodelet():
+  running(false),
+  merged_cloud(false),
+  merge_max_offset(0.05),
+  pending_sweeps(0) {
+  return;
+}
+
+LslidarC16MultiDecoderNodelet::~LslidarC16MultiDecoderNodelet() {
+  if (running) {
+    NODELET_INFO("shutting down decoder workers");
+    running = false;
+    workers.join_all();
+    NODELET_INFO("decoder workers stopped");
+  }
+  return;
+}
+
+void LslidarC16MultiDecoderNodelet::onInit() {
+  ros::NodeHandle& nh = getNodeHandle();
+  ros::NodeHandle& pnh = getPrivateNodeHandle();
+
+  std::vector<std::string> lidar_names;
+  if (!pnh.getParam("lidars", lidar_names) || lidar_names.empty()) {
+    NODELET_ERROR("Parameter ~lidars must list at least one lidar name");
+    return;
+  }
+
+  int threads = 0;
+  pnh.param<int>("threads", threads, 0);
+  if (threads <= 0)
+    threads = std::max(1u, boost::thread::hardware_concurrency());
+  // More workers than sensors would only spin on each other's locks.
+  threads = std::min<int>(threads, lidar_names.size());
+
+  pnh.param<bool>("merged_cloud", merged_cloud, false);
+  pnh.param<std::string>("merged_frame_id", merged_frame_id, "base_link");
+  pnh.param<double>("merge_max_offset", merge_max_offset, 0.05);
+  if (merged_cloud) {
+    int message_pool_size = 4;
+    pnh.param<int>("message_pool_size", message_pool_size, 4);
+    merged_pool.resize(std::max(message_pool_size, 0));
+    merged_pub = nh.advertise<sensor_msgs::PointCloud2>(
+          "lslidar_point_cloud_merged", 10);
+  }
+
+  for (size_t i = 0; i < lidar_names.size(); ++i) {
+    SensorPtr sensor(new Sensor);
+    sensor->name = lidar_names[i];
+    sensor->index = i;
+    sensor->merged = false;
+
+    ros::NodeHandle lidar_nh(nh, lidar_names[i]);
+    ros::NodeHandle lidar_pnh(pnh, lidar_names[i]);
+    lidar_nh.setCallbackQueue(&sensor->queue);
+    lidar_pnh.setCallbackQueue(&sensor->queue);
+    if (!loadExtrinsics(lidar_pnh, *sensor))
+      return;
+
+    NODELET_INFO_STREAM("Initialising decoder for lidar " << lidar_names[i]);
+    sensor->decoder.reset(new LslidarC16Decoder(lidar_nh, lidar_pnh));
+    if (!sensor->decoder->initialize()) {
+      NODELET_ERROR_STREAM("Cannot initialize the decoder of lidar " << lidar_names[i]);
+      return;
+    }
+    if (merged_cloud)
+      sensor->decoder->setMergeCallback(boost::bind(
+            &LslidarC16MultiDecoderNodelet::mergeSweep, this,
+            boost::ref(*sensor), _1, _2), merged_pub);
+    sensors.push_back(sensor);
+  }
+
+  running = true;
+  for (int i = 0; i < threads; ++i)
+    workers.create_thread(boost::bind(&LslidarC16MultiDecoderNodelet::worker, this, i));
+  NODELET_INFO("Decoding %lu lidars on %d worker threads", sensors.size(), threads);
+}
+
+/** @brief Worker thread main loop.
+ *
+ *  Worker i owns the sensors i, i + threads, ... and visits them
+ *  first. The other sensors are only taken when no one holds them.
+ */
+void LslidarC16MultiDecoderNodelet::worker(size_t index) {
+  const size_t count = sensors.size();
+  while(ros::ok() && running) {
+    bool worked = false;
+    for (size_t k = 0; k < count; ++k) {
+      Sensor& sensor = *sensors[(index + k) % count];
+      if (sensor.queue.isEmpty())
+        continue;
+      boost::mutex::scoped_lock lock(sensor.mutex, boost::try_to_lock);
+      if (!lock.owns_lock())
+        continue;
+      sensor.queue.callAvailable();
+      worked = true;
+    }
+
+    // Nothing queued anywhere, block on the first own sensor until a
+    // packet comes in.
+    if (!worked) {
+      Sensor& sensor = *sensors[index];
+      boost::mutex::scoped_lock lock(sensor.mutex);
+      sensor.queue.callAvailable(ros::WallDuration(0.001));
+    }
+  }
+}
+
+/** @brief Read ~<name>/extrinsics, [x, y, z, roll, pitch, yaw].
+ *
+ *  The pose of the sensor frame in the merged frame, in meters and
+ *  radians. The rotation is applied as yaw * pitch * roll.
+ */
+bool LslidarC16MultiDecoderNodelet::loadExtrinsics(
+    ros::NodeHandle& lidar_pnh, Sensor& sensor) {
+  std::vector<double> pose;
+  lidar_pnh.param("extrinsics", pose, std::vector<double>(6, 0.0));
+  if (pose.size() != 6) {
+    NODELET_ERROR_STREAM("Parameter ~" << sensor.name <<
+                         "/extrinsics must be [x, y, z, roll, pitch, yaw]");
+    return false;
+  }
+
+  const double cr = cos(pose[3]), sr = sin(pose[3]);
+  const double cp = cos(pose[4]), sp = sin(pose[4]);
+  const double cy = cos(pose[5]), sy = sin(pose[5]);
+  const double m[12] = {
+    cy*cp, cy*sp*sr - sy*cr, cy*sp*cr + sy*sr, pose[0],
+    sy*cp, sy*sp*sr + cy*cr, sy*sp*cr - cy*sr, pose[1],
+    -sp,   cp*sr,            cp*cr,            pose[2]
+  };
+  for (int i = 0; i < 12; ++i)
+    sensor.extrinsics[i] = m[i];
+  return true;
+}
+
+/** @brief Add a completed sweep to the pending merged cloud.
+ *
+ *  Runs on the worker decoding the sensor. The pending cloud is
+ *  published once every sensor contributed, or early when a sweep
+ *  does not fit in it: a second sweep of the same sensor, or one that
+ *  starts more than merge_max_offset later. Sweeps starting that much
+ *  earlier are too late and dropped.
+ */
+void LslidarC16MultiDecoderNodelet::mergeSweep(
+    Sensor& sensor, const LslidarC16Decoder& decoder, const ros::Time& time_base) {
+  boost::mutex::scoped_lock lock(merge_mutex);
+
+  if (pending_cloud) {
+    const double offset = (time_base - pending_base).toSec();
+    if (offset < -merge_max_offset) {
+      NODELET_WARN_THROTTLE(10, "Sweep of lidar %s is %.3f s late for the merged cloud",
+                            sensor.name.c_str(), -offset);
+      return;
+    }
+    if (sensor.merged || offset > merge_max_offset)
+      publishMerged();
+  }
+
+  if (!pending_cloud) {
+    pending_cloud = merged_pool.acquire();
+    pending_cloud->header.frame_id = merged_frame_id;
+    pending_cloud->header.stamp = time_base;
+    LslidarC16Decoder::initPointCloudFields(
+          *pending_cloud, LslidarC16Decoder::CLOUD_MERGED);
+    // Sized once for full sweeps of every sensor, pooled messages
+    // keep the capacity.
+    pending_cloud->data.reserve(
+          sensors.size() * SWEEP_RINGS * MAX_POINTS_PER_RING * MERGED_POINT_STEP);
+    pending_cloud->data.clear();
+    pending_cloud->width = 0;
+    pending_cloud->row_step = 0;
+    pending_base = time_base;
+  }
+
+  decoder.appendMergedPoints(*pending_cloud, sensor.extrinsics,
+                             (time_base - pending_base).toSec(), sensor.index);
+  sensor.merged = true;
+  if (++pending_sweeps == sensors.size())
+    publishMerged();
+}
+
+/** @brief Publish the pending merged cloud, merge_mutex held. */
+void LslidarC16MultiDecoderNodelet::publishMerged() {
+  if (pending_sweeps < sensors.size())
+    NODELET_WARN_THROTTLE(10, "Merged cloud published with %lu of %lu lidars",
+                          pending_sweeps, sensors.size());
+  merged_pub.publish(pending_cloud);
+  pending_cloud.reset();
+  pending_sweeps = 0;
+  for (size_t i = 0; i < sensors.size(); ++i)
+    sensors[i]->merged = false;
+}
+
+} // end namespace lslidar_c16_decoder
+
+PLUGINLIB_DECLARE_CLASS(lslidar_c16_decoder, LslidarC16MultiDecoderNodelet,
+    lslidar_c16_decoder::LslidarC16MultiDecoderNodelet, nodelet::Nodelet);
@@ -0,0 +1,113 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Replay a capture file written by the driver (record_file).
+ *
+ *   rosrun lslidar_c16_decoder lslidar_c16_replay_node _capture_file:=drive.lsc
+ *
+ * The packets are decoded straight from the file mapping and the
+ * decoder outputs are published as usual, with the recorded stamps.
+ * rate scales the recorded packet times, 0 replays as fast as the
+ * decoder goes.
+ */
+
+#include <cstring>
+#include <string>
+
+#include <ros/ros.h>
+
+#include <lslidar_c16_msgs/LslidarC16Packet.h>
+#include <lslidar_c16_driver/capture_file.h>
+#include <lslidar_c16_decoder/lslidar_c16_decoder.h>
+
+using namespace lslidar_c16_decoder;
+
+int main(int argc, char** argv) {
+    ros::init(argc, argv, "lslidar_c16_replay_node");
+    ros::NodeHandle nh;
+    ros::NodeHandle pnh("~");
+
+    std::string capture_file;
+    double rate;
+    double start;
+    bool loop;
+    bool publish_packets;
+    pnh.param("capture_file", capture_file, std::string(""));
+    pnh.param<double>("rate", rate, 1.0);
+    pnh.param<double>("start", start, 0.0);
+    pnh.param<bool>("loop", loop, false);
+    pnh.param<bool>("publish_packets", publish_packets, false);
+
+    lslidar_c16_driver::CaptureReader capture;
+    if (!capture.open(capture_file)) return -1;
+    if (capture.size() == 0) {
+        ROS_ERROR("No packets in %s", capture_file.c_str());
+        return -1;
+    }
+
+    LslidarC16DecoderPtr decoder(new LslidarC16Decoder(nh, pnh));
+    if (!decoder->initialize(LslidarC16Decoder::DIRECT_PACKETS)) {
+        ROS_ERROR("Cannot initialize the decoder...");
+        return -1;
+    }
+
+    ros::Publisher packet_pub;
+    if (publish_packets)
+        packet_pub = nh.advertise<lslidar_c16_msgs::LslidarC16Packet>(
+                    "lslidar_packet", 100);
+
+    const uint64_t first = capture.find(capture.stamp(0) + ros::Duration(start));
+    ROS_INFO("Replaying %lu packets of %s at rate %.2f",
+             (unsigned long)(capture.size() - first), capture_file.c_str(), rate);
+
+    do {
+        const ros::WallTime wall_start = ros::WallTime::now();
+        const ros::Time capture_start = capture.stamp(first);
+        uint64_t i = first;
+
+        for (; i < capture.size() && ros::ok(); ++i) {
+            const ros::Time stamp = capture.stamp(i);
+            if (rate > 0.0) {
+                // Wait until the packet is due.
+                const ros::WallTime due = wall_start +
+                        ros::WallDuration((stamp - capture_start).toSec() / rate);
+                const ros::WallDuration wait = due - ros::WallTime::now();
+                if (wait > ros::WallDuration(0)) wait.sleep();
+            }
+
+            decoder->processPacket(capture.packet(i), stamp);
+
+            if (publish_packets && packet_pub.getNumSubscribers() > 0) {
+                lslidar_c16_msgs::LslidarC16PacketPtr packet(
+                            new lslidar_c16_msgs::LslidarC16Packet());
+                packet->stamp = stamp;
+                memcpy(&packet->data[0], capture.packet(i), packet->data.size());
+                packet_pub.publish(packet);
+            }
+
+            if (i % 64 == 0) ros::spinOnce();
+        }
+
+        const double seconds = (ros::WallTime::now() - wall_start).toSec();
+        ROS_INFO("Replayed %lu packets in %.2f s, %.0f packets/s",
+                 (unsigned long)(i - first), seconds,
+                 seconds > 0.0 ? (i - first) / seconds : 0.0);
+    } while (loop && ros::ok());
+
+    return 0;
+}
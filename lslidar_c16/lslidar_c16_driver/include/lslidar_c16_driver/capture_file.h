@@ -0,0 +1,159 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_CAPTURE_FILE_H
+#define LSLIDAR_C16_CAPTURE_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <ros/time.h>
+
+namespace lslidar_c16_driver {
+
+/*
+ * Capture file layout, all fields little-endian:
+ *
+ *   CaptureHeader      one page
+ *   CaptureIndexEntry  one per CAPTURE_INDEX_INTERVAL records
+ *   CaptureRecord      capacity fixed-size records, page aligned
+ *
+ * The file is preallocated for its full capacity when it is created
+ * and shrunk to the records written when it is closed. count is
+ * updated after every record, so the file stays readable if the
+ * recorder dies.
+ */
+static const char CAPTURE_MAGIC[8] = {'L', 'S', 'C', '1', '6', 'C', 'A', 'P'};
+static const uint32_t CAPTURE_VERSION = 1;
+static const uint32_t CAPTURE_PACKET_SIZE = 1206;
+static const uint32_t CAPTURE_INDEX_INTERVAL = 1024;
+
+struct CaptureHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;       ///< sizeof(CaptureRecord)
+    uint64_t capacity;          ///< records the file was sized for
+    uint64_t count;             ///< records written
+    uint32_t index_interval;    ///< records per index entry
+    uint32_t reserved;
+    uint64_t index_offset;      ///< bytes from the start of the file
+    uint64_t records_offset;
+};
+
+/// Receive time of the first record of every index interval.
+struct CaptureIndexEntry {
+    uint32_t sec;
+    uint32_t nsec;
+};
+
+struct CaptureRecord {
+    uint32_t sec;               ///< receive time
+    uint32_t nsec;
+    uint8_t data[CAPTURE_PACKET_SIZE];
+    uint8_t padding[2];
+};
+
+/** @brief Appends raw packets to a memory-mapped capture file.
+ *
+ *  append() only copies the packet into the mapping, the kernel
+ *  writes the pages back in the background. Written chunks are
+ *  handed to writeback and dropped from the mapping as recording
+ *  goes on, so the page cache does not grow with the file.
+ */
+class CaptureWriter {
+public:
+
+    CaptureWriter();
+    ~CaptureWriter();
+
+    // Create path with room for capacity packets, replacing any
+    // existing file.
+    bool open(const std::string& path, uint64_t capacity);
+    void close();
+
+    // Returns false, and counts the packet as dropped, once the file
+    // is full.
+    bool append(const uint8_t* data, const ros::Time& stamp);
+
+    bool isOpen() const { return header != NULL; }
+    uint64_t size() const {
+        return header != NULL ? __atomic_load_n(&header->count, __ATOMIC_ACQUIRE) : 0;
+    }
+    uint64_t capacity() const { return header != NULL ? header->capacity : 0; }
+    uint64_t getDropped() const { return dropped; }
+    const std::string& getPath() const { return path; }
+
+private:
+
+    CaptureWriter(const CaptureWriter&);
+    CaptureWriter& operator=(const CaptureWriter&);
+
+    void flushChunk(uint64_t chunk);
+
+    std::string path;
+    int fd;
+    uint8_t* map;
+    size_t map_size;
+    CaptureHeader* header;
+    CaptureIndexEntry* index;
+    CaptureRecord* records;
+    uint64_t flushed_chunks;    ///< chunks handed to writeback
+    uint64_t dropped;
+};
+
+/** @brief Read-only view of a capture file.
+ *
+ *  The records are read straight from the mapping, packet() stays
+ *  valid until the reader is closed.
+ */
+class CaptureReader {
+public:
+
+    CaptureReader();
+    ~CaptureReader();
+
+    bool open(const std::string& path);
+    void close();
+
+    uint64_t size() const { return count; }
+    const uint8_t* packet(uint64_t i) const { return records[i].data; }
+    ros::Time stamp(uint64_t i) const {
+        return ros::Time(records[i].sec, records[i].nsec);
+    }
+
+    // First record received at or after stamp, size() if there is
+    // none. Assumes the stamps are increasing, as receive times are.
+    uint64_t find(const ros::Time& stamp) const;
+
+private:
+
+    CaptureReader(const CaptureReader&);
+    CaptureReader& operator=(const CaptureReader&);
+
+    int fd;
+    uint8_t* map;
+    size_t map_size;
+    const CaptureIndexEntry* index;
+    const CaptureRecord* records;
+    uint64_t index_interval;
+    uint64_t count;
+};
+
+} // namespace lslidar_c16_driver
+
+#endif // LSLIDAR_C16_CAPTURE_FILE_H
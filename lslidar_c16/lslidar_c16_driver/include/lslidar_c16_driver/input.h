@@ -0,0 +1,243 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_INPUT_H
+#define LSLIDAR_C16_INPUT_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include <ros/ros.h>
+
+#include <lslidar_c16_driver/capture_file.h>
+#include <lslidar_c16_driver/packet_format.h>
+
+namespace lslidar_c16_driver {
+
+//static uint16_t UDP_PORT_NUMBER = 8080;
+
+// Source of the packet->stamp field.
+enum TimestampMode {
+    TIMESTAMP_GPS,          ///< FPGA/GPS time carried in the packets
+    TIMESTAMP_KERNEL,       ///< kernel receive time (SO_TIMESTAMPNS)
+    TIMESTAMP_HARDWARE      ///< NIC receive time (SO_TIMESTAMPING)
+};
+
+/** @brief Source of raw lslidar packets.
+ *
+ *  The packet data handed out stays valid until the next call. The
+ *  stamp is the receive time of the packet, zero when the input has
+ *  none.
+ */
+class Input {
+public:
+
+    virtual ~Input() {}
+
+    // Wait for the next packet. Returns 0 for a packet, 1 on a
+    // timeout and -1 at the end of the input.
+    virtual int getPacket(const uint8_t*& data, ros::Time& stamp) = 0;
+
+    // The next packet if it is available without waiting.
+    virtual bool takePacket(const uint8_t*& data, ros::Time& stamp) = 0;
+
+    // Descriptor that becomes readable when takePacket() has
+    // packets, -1 if there is none.
+    virtual int getFd() const { return -1; }
+
+    // Packets the input lost before they could be read, e.g. because
+    // the socket buffer was full.
+    virtual uint64_t getDrops() const { return 0; }
+};
+
+typedef boost::shared_ptr<Input> InputPtr;
+
+/** @brief Live packets from the UDP socket.
+ *
+ *  Every datagram queued on the socket is drained with one
+ *  recvmmsg() call into a preallocated ring, and handed out from
+ *  there.
+ */
+class InputSocket: public Input {
+public:
+
+    InputSocket();
+    ~InputSocket();
+
+    // Listen on port for packets from lidar_ip, any sender if it is
+    // empty, joining group_ip unless it is empty. Falls back to the
+    // GPS time when the requested stamps are not available. The
+    // socket buffer is sized for buffer_packets datagrams, 0 keeps the
+    // kernel default.
+    bool open(int port, const std::string& lidar_ip,
+              const std::string& group_ip, int batch_size,
+              TimestampMode timestamp_mode, int buffer_packets = 0);
+
+    virtual int getPacket(const uint8_t*& data, ros::Time& stamp);
+
+    // Packets left in the ring, then one recvmmsg() at a time until
+    // the socket queue is empty.
+    virtual bool takePacket(const uint8_t*& data, ros::Time& stamp);
+
+    virtual int getFd() const { return socket_id; }
+
+    // Datagrams dropped by the kernel as reported with SO_RXQ_OVFL.
+    virtual uint64_t getDrops() const { return drops; }
+
+private:
+
+    bool enableTimestamping();
+    void setReceiveBuffer(int packets);
+    bool parseControl(const msghdr& hdr, ros::Time& stamp);
+    static bool hardwareStampUsable(const timespec& hardware, const timespec& software);
+    int receivePackets();
+    bool takeReceivedPacket(const uint8_t*& data, ros::Time& stamp);
+
+    int socket_id;
+    in_addr lidar_ip;
+    bool filter_ip;
+    TimestampMode timestamp_mode;
+
+    // Batched receive ring filled by recvmmsg()
+    int batch_size;
+    int batch_count;      ///< datagrams received by the last recvmmsg()
+    int batch_index;      ///< next datagram in the ring to hand out
+    bool drained;         ///< the last recvmmsg() emptied the socket queue
+    uint64_t drops;
+    uint32_t last_drop_count;
+    std::vector<uint8_t> batch_buffer;
+    std::vector<mmsghdr> batch_msgs;
+    std::vector<iovec> batch_iovecs;
+    std::vector<sockaddr_in> batch_addrs;
+    std::vector<char> batch_control;    ///< cmsg space for stamps and drops
+};
+
+/** @brief Recorded packets, handed out at the pace they were received.
+ *
+ *  rate scales the recorded packet times, 0 hands the packets out as
+ *  fast as they are asked for. With loop the input starts over at the
+ *  end of the file instead of ending.
+ */
+class InputFile: public Input {
+public:
+
+    virtual int getPacket(const uint8_t*& data, ros::Time& stamp);
+    virtual bool takePacket(const uint8_t*& data, ros::Time& stamp);
+
+protected:
+
+    InputFile(double rate, bool loop);
+
+    // The packets of the file in order, false at its end.
+    virtual bool next(const uint8_t*& data, ros::Time& stamp) = 0;
+    virtual void rewind() = 0;
+
+private:
+
+    bool fetch();
+    ros::WallTime dueTime() const;
+
+    double rate;
+    bool loop;
+    bool started;               ///< file_start and wall_start are set
+    ros::Time file_start;
+    ros::WallTime wall_start;
+
+    bool pending;               ///< the next packet was read, not handed out
+    const uint8_t* pending_data;
+    ros::Time pending_stamp;
+};
+
+/** @brief Packets from a pcap file, read through a memory mapping.
+ *
+ *  Ethernet and Linux cooked captures are supported. Only UDP
+ *  payloads in one of the PACKET_FORMATS sent from lidar_ip (any
+ *  sender if empty) to port (any port if 0) are handed out, stamped
+ *  with the capture time.
+ */
+class InputPCAP: public InputFile {
+public:
+
+    InputPCAP(double rate = 0.0, bool loop = false);
+    ~InputPCAP();
+
+    bool open(const std::string& path, const std::string& lidar_ip = "",
+              int port = 0);
+
+protected:
+
+    virtual bool next(const uint8_t*& data, ros::Time& stamp);
+    virtual void rewind();
+
+private:
+
+    uint32_t readU32(const uint8_t* p) const;
+
+    uint8_t* map;
+    size_t map_size;
+    size_t offset;              ///< next record
+    bool swapped;               ///< written with the other byte order
+    bool nanoseconds;
+    uint32_t link_type;
+    in_addr lidar_ip;
+    bool filter_ip;
+    uint16_t port;
+};
+
+/** @brief Packets from a capture file written with record_file. */
+class InputCapture: public InputFile {
+public:
+
+    InputCapture(double rate = 0.0, bool loop = false);
+
+    bool open(const std::string& path);
+
+protected:
+
+    virtual bool next(const uint8_t*& data, ros::Time& stamp);
+    virtual void rewind();
+
+private:
+
+    CaptureReader capture;
+    uint64_t index;
+};
+
+enum InputFileType {
+    INPUT_FILE_UNKNOWN,
+    INPUT_FILE_PCAP,
+    INPUT_FILE_CAPTURE
+};
+
+// Tell the file types apart by their magic number.
+InputFileType detectInputFile(const std::string& path);
+
+// Open a pcap or capture file, NULL if it cannot be read. lidar_ip
+// and port only filter pcap files.
+InputPtr openInputFile(const std::string& path, double rate, bool loop,
+                       const std::string& lidar_ip = "", int port = 0);
+
+} // namespace lslidar_c16_driver
+
+#endif // LSLIDAR_C16_INPUT_H
@@ -20,9 +20,9 @@
 
 #include <unistd.h>
 #include <stdio.h>
-#include <netinet/in.h>
 #include <string>
 
+#include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <ros/ros.h>
@@ -32,10 +32,13 @@
 #include <lslidar_c16_msgs/LslidarC16Packet.h>
 #include <lslidar_c16_msgs/LslidarC16ScanUnified.h>
 
-namespace lslidar_c16_driver {
+#include <lslidar_c16_driver/capture_file.h>
+#include <lslidar_c16_driver/input.h>
+#include <lslidar_c16_driver/message_pool.h>
+#include <lslidar_c16_driver/packet_format.h>
+#include <lslidar_c16_driver/statistics.h>
 
-//static uint16_t UDP_PORT_NUMBER = 8080;
-static uint16_t PACKET_SIZE = 1206;
+namespace lslidar_c16_driver {
 
 class LslidarC16Driver {
 public:
@@ -46,8 +49,37 @@ public:
     bool initialize();
     bool polling();
 
+    // Packet message to receive into, taken from the packet pool
+    // when one is configured.
+    lslidar_c16_msgs::LslidarC16PacketPtr allocatePacket();
+
+    // The two halves of polling(), for callers that receive and
+    // publish packets on different threads.
+    bool receivePacket(lslidar_c16_msgs::LslidarC16PacketPtr& packet);
+    void publishPacket(const lslidar_c16_msgs::LslidarC16PacketPtr& packet);
+
+    // Receive without a packet message. data points into the receive
+    // ring and stays valid until the next receive call.
+    bool receiveRawPacket(const uint8_t*& data, ros::Time& stamp);
+    void tickDiagnostics(const ros::Time& stamp);
+    uint32_t getNumPacketSubscribers() const;
+
+    // Receive and publish every packet queued on the socket without
+    // blocking, for callers that wait on the socket themselves.
+    int drainSocket();
+    int getSocket() const { return input->getFd(); }
+
+    void addDiagnosticTask(const std::string& name,
+                           const diagnostic_updater::TaskFunction& task);
+
+    // Shared with the owner, which may add its own counters and
+    // histograms before it starts receiving.
+    Statistics& getStatistics() { return statistics; }
+
     void initTimeStamp(void);
     void getFPGA_GPSTimeStamp(lslidar_c16_msgs::LslidarC16PacketPtr &packet);
+    void getFPGA_GPSTimeStamp(const uint8_t* data);
+    void getFPGA_GPSTimeStamp(const uint8_t* data, const PacketFormat& format);
 
     typedef boost::shared_ptr<LslidarC16Driver> LslidarC16DriverPtr;
     typedef boost::shared_ptr<const LslidarC16Driver> LslidarC16DriverConstPtr;
@@ -56,18 +88,45 @@ private:
 
     bool loadParameters();
     bool createRosIO();
-    bool openUDPPort();
+    bool openInput();
+    bool openRecorder();
+    void recorderDiagnostics(diagnostic_updater::DiagnosticStatusWrapper& stat);
+    void statisticsDiagnostics(diagnostic_updater::DiagnosticStatusWrapper& stat);
+    void rateDiagnostics(diagnostic_updater::DiagnosticStatusWrapper& stat);
     int getPacket(lslidar_c16_msgs::LslidarC16PacketPtr& msg);
+    int getRawPacket(const uint8_t*& data, ros::Time& stamp);
+    bool takePacket(lslidar_c16_msgs::LslidarC16PacketPtr& packet);
+    bool takeRawPacket(const uint8_t*& data, ros::Time& stamp);
+    void acceptPacket(const uint8_t* data, ros::Time& stamp);
 
     // Ethernet relate variables
     std::string lidar_ip_string;
     std::string group_ip_string;
-    in_addr lidar_ip;
     int UDP_PORT_NUMBER;
-    int socket_id;
     int cnt_gps_ts;
     bool use_gps_;
 	bool add_multicast;
+    std::string timestamp_mode_string;
+    TimestampMode timestamp_mode;
+    int batch_size;
+    double socket_buffer_time;
+
+    // The live socket, or the file in input_file
+    std::string input_file;
+    double input_rate;
+    bool input_loop;
+    InputPtr input;
+
+    // Recycled packet messages, see allocatePacket()
+    int packet_pool_size;
+    MessagePool<lslidar_c16_msgs::LslidarC16Packet> packet_pool;
+
+    // Every accepted datagram is appended to the capture file, see
+    // capture_file.h
+    std::string record_file;
+    int record_packets;
+    boost::shared_ptr<CaptureWriter> recorder;
+
     // ROS related variables
     ros::NodeHandle nh;
     ros::NodeHandle pnh;
@@ -79,6 +138,30 @@ private:
     double diag_min_freq;
     double diag_max_freq;
 
+    // Rotation seen in the azimuth of the packets, see acceptPacket().
+    // The expected packet rate is frequency times the packets per
+    // revolution.
+    double frequency;
+    int last_rotation;
+    Counter rotation_advance;       ///< 0.01 degree
+    Counter steady_advance;         ///< without the gaps of lost packets
+    Counter steady_packets;
+    ros::WallTime diag_rate_time;
+    uint64_t diag_rotation_advance;
+    uint64_t diag_steady_advance;
+    uint64_t diag_steady_packets;
+
+    // Hot path counters, reported in the diagnostics and on
+    // lslidar_driver_statistics
+    double statistics_period;
+    Statistics statistics;
+    Statistics::Snapshot diag_statistics;
+    StatisticsPublisher statistics_pub;
+    Counter& packets_received;
+    Counter& socket_drops;
+    Histogram& receive_latency;     ///< receive to publish [us]
+    uint64_t diag_socket_drops;
+
     uint64_t pointcloudTimeStamp;
     uint64_t GPSStableTS;
     uint64_t GPSCountingTS;
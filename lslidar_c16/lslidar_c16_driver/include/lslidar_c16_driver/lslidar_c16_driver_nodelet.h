@@ -16,6 +16,7 @@
  */
 
 #include <string>
+#include <atomic>
 #include <boost/thread.hpp>
 
 #include <ros/ros.h>
@@ -23,6 +24,7 @@
 #include <nodelet/nodelet.h>
 
 #include <lslidar_c16_driver/lslidar_c16_driver.h>
+#include <lslidar_c16_driver/spsc_ring.h>
 
 namespace lslidar_c16_driver
 {
@@ -38,10 +40,23 @@ private:
 
   virtual void onInit(void);
   virtual void devicePoll(void);
+  virtual void receivePoll(void);
+  virtual void publishPoll(void);
+  void ringDiagnostics(diagnostic_updater::DiagnosticStatusWrapper& stat);
 
   volatile bool running;               ///< device thread is running
   boost::shared_ptr<boost::thread> device_thread;
 
+  // Two-stage mode: device_thread only receives packets and hands
+  // them to publish_thread through a lock-free ring.
+  bool two_stage;
+  int receive_cpu;                     ///< core to pin device_thread to, -1 for none
+  boost::shared_ptr<boost::thread> publish_thread;
+  typedef SpscRing<lslidar_c16_msgs::LslidarC16PacketPtr> PacketRing;
+  boost::shared_ptr<PacketRing> packet_ring;
+  std::atomic<uint64_t> ring_overruns;
+  Histogram* ring_depth;               ///< packets queued behind each push
+
   LslidarC16DriverPtr lslidar_c16_driver; ///< driver implementation class
 };
 
@@ -0,0 +1,58 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_MULTI_DRIVER_H
+#define LSLIDAR_C16_MULTI_DRIVER_H
+
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+
+#include <lslidar_c16_driver/lslidar_c16_driver.h>
+
+namespace lslidar_c16_driver {
+
+/** @brief Serves several C16 units from one thread.
+ *
+ *  The names in the ~lidars list select one parameter namespace per
+ *  sensor (~<name>/lidar_ip, ~<name>/device_port, ...). Each sensor
+ *  publishes on <name>/lslidar_packet, and all sockets are waited on
+ *  by a single epoll loop.
+ */
+class LslidarC16MultiDriver {
+public:
+
+    LslidarC16MultiDriver(ros::NodeHandle& n, ros::NodeHandle& pn);
+    ~LslidarC16MultiDriver();
+
+    bool initialize();
+    bool polling();
+
+private:
+
+    ros::NodeHandle nh;
+    ros::NodeHandle pnh;
+
+    int epoll_id;
+    std::vector<std::string> lidar_names;
+    std::vector<LslidarC16DriverPtr> drivers;
+};
+
+} // namespace lslidar_c16_driver
+
+#endif // LSLIDAR_C16_MULTI_DRIVER_H
@@ -0,0 +1,80 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_MESSAGE_POOL_H
+#define LSLIDAR_C16_MESSAGE_POOL_H
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+
+namespace lslidar_c16_driver {
+
+/** @brief Fixed free-list of messages recycled once published.
+ *
+ *  The pool keeps one reference to every message it owns. A message
+ *  is free again as soon as that reference is the only one left, i.e.
+ *  when every subscriber and queue has dropped it. acquire() must be
+ *  called from a single thread. When every message is still in use
+ *  acquire() falls back to allocating a new one.
+ */
+template <typename M>
+class MessagePool {
+public:
+
+    typedef boost::shared_ptr<M> MessagePtr;
+
+    explicit MessagePool(size_t size = 0):
+        next(0),
+        misses(0) {
+        resize(size);
+    }
+
+    void resize(size_t size) {
+        messages.clear();
+        for (size_t i = 0; i < size; ++i)
+            messages.push_back(boost::make_shared<M>());
+        next = 0;
+    }
+
+    MessagePtr acquire() {
+        for (size_t n = 0; n < messages.size(); ++n) {
+            const MessagePtr& msg = messages[next];
+            next = next + 1 < messages.size() ? next + 1 : 0;
+            if (msg.unique())
+                return msg;
+        }
+        if (!messages.empty())
+            ++misses;
+        return boost::make_shared<M>();
+    }
+
+    size_t size() const { return messages.size(); }
+    size_t getMisses() const { return misses; }
+
+private:
+
+    std::vector<MessagePtr> messages;
+    size_t next;
+    size_t misses;      ///< acquire() calls that found no free message
+};
+
+} // namespace lslidar_c16_driver
+
+#endif // LSLIDAR_C16_MESSAGE_POOL_H
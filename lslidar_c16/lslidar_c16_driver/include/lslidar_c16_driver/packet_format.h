@@ -0,0 +1,72 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_PACKET_FORMAT_H
+#define LSLIDAR_C16_PACKET_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace lslidar_c16_driver {
+
+/** @brief Layout of a datagram sent by the C16.
+ *
+ *  A packet is recognised by its size and its leading header bytes.
+ *  The data packets begin with the 2-byte block flag of their first
+ *  block, the device packets with a 4-byte magic. The offsets tell
+ *  where the time fields are, 0 if the packet has none.
+ */
+struct PacketFormat {
+    const char* name;
+    uint16_t size;              ///< datagram bytes
+    uint8_t header[4];          ///< leading bytes
+    uint8_t header_size;        ///< 2 or 4
+    bool data;                  ///< holds firings for the decoder
+    uint16_t fpga_time_offset;  ///< uint32 microseconds in the second
+    uint16_t utc_time_offset;   ///< year, month, day, hour, minute, second bytes
+};
+
+// Every packet layout the driver accepts. A new firmware layout is a
+// new entry. All of them are MAX_PACKET_SIZE bytes, the size of
+// LslidarC16Packet::data, so that packets are copied and recorded
+// whole.
+static const PacketFormat PACKET_FORMATS[] = {
+    {"data",   1206, {0xff, 0xee, 0x00, 0x00}, 2, true,  1200, 0},
+    {"device", 1206, {0xa5, 0xff, 0x00, 0x5a}, 4, false, 0,    36},
+};
+static const size_t PACKET_FORMAT_COUNT =
+        sizeof(PACKET_FORMATS) / sizeof(PACKET_FORMATS[0]);
+
+// Size of LslidarC16Packet::data and of the slots of the receive ring.
+static const size_t MAX_PACKET_SIZE = 1206;
+
+// The layout of the size bytes at data, NULL for a datagram that is
+// no C16 packet.
+inline const PacketFormat* findPacketFormat(const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < PACKET_FORMAT_COUNT; ++i) {
+        const PacketFormat& format = PACKET_FORMATS[i];
+        if (size == format.size &&
+                memcmp(data, format.header, format.header_size) == 0)
+            return &format;
+    }
+    return NULL;
+}
+
+} // namespace lslidar_c16_driver
+
+#endif // LSLIDAR_C16_PACKET_FORMAT_H
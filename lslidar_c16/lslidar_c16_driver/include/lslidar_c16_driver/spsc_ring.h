@@ -0,0 +1,92 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_SPSC_RING_H
+#define LSLIDAR_C16_SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace lslidar_c16_driver {
+
+/** @brief Lock-free single-producer/single-consumer ring.
+ *
+ *  push() may only be called from one thread and pop() from one
+ *  other thread. The capacity is rounded up to a power of two.
+ */
+template <typename T>
+class SpscRing {
+public:
+
+    explicit SpscRing(size_t min_capacity):
+        head(0),
+        tail(0) {
+        size_t capacity = 1;
+        while (capacity < min_capacity)
+            capacity <<= 1;
+        slots.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    /// Producer side. Returns false if the ring is full.
+    bool push(const T& item) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) > mask)
+            return false;
+        slots[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer side. Returns false if the ring is empty.
+    bool pop(T& item) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+        item = slots[t & mask];
+        slots[t & mask] = T();
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return head.load(std::memory_order_acquire) -
+                tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+
+    std::vector<T> slots;
+    size_t mask;
+
+    // Keep the two indices on separate cache lines so the producer
+    // and the consumer do not invalidate each other's line.
+    char pad0[64];
+    std::atomic<size_t> head;   ///< next slot to write
+    char pad1[64];
+    std::atomic<size_t> tail;   ///< next slot to read
+    char pad2[64];
+};
+
+} // namespace lslidar_c16_driver
+
+#endif // LSLIDAR_C16_SPSC_RING_H
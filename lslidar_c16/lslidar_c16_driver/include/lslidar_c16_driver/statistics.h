@@ -0,0 +1,155 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LSLIDAR_C16_STATISTICS_H
+#define LSLIDAR_C16_STATISTICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ros/ros.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+
+#include <lslidar_c16_msgs/LslidarC16Statistics.h>
+
+namespace lslidar_c16_driver {
+
+// Monotonic time for the latency histograms [ns].
+inline uint64_t monotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+typedef std::atomic<uint64_t> Counter;
+
+/** @brief Lock-free histogram of non-negative integers.
+ *
+ *  Every octave is split into four buckets, so the percentiles are
+ *  within 25% of the true value. add() may be called from any thread,
+ *  it costs a few relaxed atomic additions.
+ */
+class Histogram {
+public:
+
+    // Values from 2^40 up all go into the last bucket.
+    static const int BUCKETS = 4 + 38*4;
+
+    struct Snapshot {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t buckets[BUCKETS];
+
+        double mean() const { return count > 0 ? double(sum) / count : 0.0; }
+        double percentile(double q) const;
+        double max() const { return percentile(1.0); }
+        Snapshot operator-(const Snapshot& earlier) const;
+    };
+
+    Histogram() {
+        sum = 0;
+        for (int i = 0; i < BUCKETS; ++i)
+            buckets[i] = 0;
+    }
+
+    void add(uint64_t value) {
+        buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const;
+
+    static int bucket(uint64_t value) {
+        if (value < 4)
+            return value;
+        const int octave = 63 - __builtin_clzll(value);
+        const int b = 4 + (octave - 2)*4 + ((value >> (octave - 2)) & 3);
+        return b < BUCKETS ? b : BUCKETS - 1;
+    }
+    static double bucketLow(int b);
+
+private:
+
+    Histogram(const Histogram&);
+    Histogram& operator=(const Histogram&);
+
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> buckets[BUCKETS];
+};
+
+/** @brief Named counters and histograms of one component.
+ *
+ *  Counters hold totals, histograms are reported for the values added
+ *  since the previous report of the same reader, whose state is kept
+ *  in a Snapshot. Adding to a counter or histogram never locks, only
+ *  registering and reporting do.
+ */
+class Statistics {
+public:
+
+    struct Snapshot {
+        std::vector<uint64_t> counters;
+        std::vector<Histogram::Snapshot> histograms;
+    };
+
+    Counter& addCounter(const std::string& name);
+    Histogram& addHistogram(const std::string& name, const std::string& unit);
+
+    void report(Snapshot& last, diagnostic_updater::DiagnosticStatusWrapper& stat) const;
+    void report(Snapshot& last, lslidar_c16_msgs::LslidarC16Statistics& msg) const;
+
+private:
+
+    void snapshot(Snapshot& last, Snapshot& interval) const;
+
+    mutable boost::mutex mutex;
+    std::vector<std::string> counter_names;
+    std::vector<boost::shared_ptr<Counter> > counters;
+    std::vector<std::string> histogram_names;
+    std::vector<std::string> histogram_units;
+    std::vector<boost::shared_ptr<Histogram> > histograms;
+};
+
+/** @brief Publishes a Statistics on a topic at a low, fixed rate. */
+class StatisticsPublisher {
+public:
+
+    // Nothing is published when period is not positive.
+    void start(const Statistics& statistics, ros::NodeHandle& nh,
+               const std::string& topic, const std::string& source,
+               double period);
+
+private:
+
+    void publish(const ros::WallTimerEvent& event);
+
+    const Statistics* statistics;
+    std::string source;
+    Statistics::Snapshot last;
+    ros::Publisher pub;
+    ros::WallTimer timer;
+};
+
+} // namespace lslidar_c16_driver
+
+#endif // LSLIDAR_C16_STATISTICS_H
@@ -0,0 +1,277 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ros/console.h>
+
+#include <lslidar_c16_driver/capture_file.h>
+
+namespace lslidar_c16_driver {
+
+// Written records are handed to writeback in chunks of this size.
+static const uint64_t CAPTURE_CHUNK_SIZE = 64 << 20;
+
+static uint64_t roundUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+CaptureWriter::CaptureWriter():
+    fd(-1),
+    map(NULL),
+    map_size(0),
+    header(NULL),
+    index(NULL),
+    records(NULL),
+    flushed_chunks(0),
+    dropped(0) {
+    return;
+}
+
+CaptureWriter::~CaptureWriter() {
+    close();
+}
+
+bool CaptureWriter::open(const std::string& file, uint64_t packets) {
+    close();
+
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+    const uint64_t index_entries = packets / CAPTURE_INDEX_INTERVAL + 1;
+    const uint64_t index_offset = roundUp(sizeof(CaptureHeader), page);
+    const uint64_t records_offset = roundUp(
+                index_offset + index_entries * sizeof(CaptureIndexEntry), page);
+    const uint64_t size = records_offset + packets * sizeof(CaptureRecord);
+
+    fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ROS_ERROR("Cannot create capture file %s: %s",
+                  file.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Allocate every block up front, so that writing to the mapping
+    // never waits for the file system to find space.
+    int rc = posix_fallocate(fd, 0, size);
+    if (rc != 0) {
+        ROS_ERROR("Cannot allocate %lu bytes for capture file %s: %s",
+                  (unsigned long)size, file.c_str(), strerror(rc));
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        ROS_ERROR("Cannot map capture file %s: %s",
+                  file.c_str(), strerror(errno));
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    (void) madvise(addr, size, MADV_SEQUENTIAL);
+
+    path = file;
+    map = static_cast<uint8_t*>(addr);
+    map_size = size;
+    header = reinterpret_cast<CaptureHeader*>(map);
+    index = reinterpret_cast<CaptureIndexEntry*>(map + index_offset);
+    records = reinterpret_cast<CaptureRecord*>(map + records_offset);
+    flushed_chunks = 0;
+    dropped = 0;
+
+    memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+    header->version = CAPTURE_VERSION;
+    header->record_size = sizeof(CaptureRecord);
+    header->capacity = packets;
+    header->count = 0;
+    header->index_interval = CAPTURE_INDEX_INTERVAL;
+    header->reserved = 0;
+    header->index_offset = index_offset;
+    header->records_offset = records_offset;
+    return true;
+}
+
+void CaptureWriter::close() {
+    if (header == NULL)
+        return;
+
+    const uint64_t count = header->count;
+    const uint64_t used = header->records_offset + count * sizeof(CaptureRecord);
+    (void) msync(map, map_size, MS_SYNC);
+    (void) munmap(map, map_size);
+
+    // Give the unused part of the preallocation back.
+    if (ftruncate(fd, used) != 0)
+        ROS_WARN("Cannot shrink capture file %s: %s",
+                 path.c_str(), strerror(errno));
+    ::close(fd);
+    ROS_INFO("Closed capture file %s: %lu packets, %lu dropped",
+             path.c_str(), (unsigned long)count, (unsigned long)dropped);
+
+    fd = -1;
+    map = NULL;
+    map_size = 0;
+    header = NULL;
+    index = NULL;
+    records = NULL;
+}
+
+bool CaptureWriter::append(const uint8_t* data, const ros::Time& stamp) {
+    const uint64_t n = header->count;
+    if (n >= header->capacity) {
+        ++dropped;
+        return false;
+    }
+
+    CaptureRecord& record = records[n];
+    record.sec = stamp.sec;
+    record.nsec = stamp.nsec;
+    memcpy(record.data, data, CAPTURE_PACKET_SIZE);
+    if (n % CAPTURE_INDEX_INTERVAL == 0) {
+        index[n / CAPTURE_INDEX_INTERVAL].sec = stamp.sec;
+        index[n / CAPTURE_INDEX_INTERVAL].nsec = stamp.nsec;
+    }
+
+    // Count the record only once it is complete.
+    __atomic_store_n(&header->count, n + 1, __ATOMIC_RELEASE);
+
+    if ((n + 1) * sizeof(CaptureRecord) / CAPTURE_CHUNK_SIZE > flushed_chunks)
+        flushChunk(flushed_chunks++);
+    return true;
+}
+
+void CaptureWriter::flushChunk(uint64_t chunk) {
+    // Start writing this chunk back without waiting for it, and drop
+    // the chunk before, which had a whole chunk time to reach the
+    // disk, from the mapping and the page cache.
+    const off_t offset = header->records_offset + chunk * CAPTURE_CHUNK_SIZE;
+    (void) sync_file_range(fd, offset, CAPTURE_CHUNK_SIZE, SYNC_FILE_RANGE_WRITE);
+    if (chunk > 0) {
+        uint8_t* previous = reinterpret_cast<uint8_t*>(records) +
+                (chunk - 1) * CAPTURE_CHUNK_SIZE;
+        (void) madvise(previous, CAPTURE_CHUNK_SIZE, MADV_DONTNEED);
+        (void) posix_fadvise(fd, offset - CAPTURE_CHUNK_SIZE,
+                             CAPTURE_CHUNK_SIZE, POSIX_FADV_DONTNEED);
+    }
+}
+
+CaptureReader::CaptureReader():
+    fd(-1),
+    map(NULL),
+    map_size(0),
+    index(NULL),
+    records(NULL),
+    index_interval(CAPTURE_INDEX_INTERVAL),
+    count(0) {
+    return;
+}
+
+CaptureReader::~CaptureReader() {
+    close();
+}
+
+bool CaptureReader::open(const std::string& path) {
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ROS_ERROR("Cannot open capture file %s: %s",
+                  path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+            static_cast<uint64_t>(st.st_size) < sizeof(CaptureHeader)) {
+        ROS_ERROR("%s is not a capture file", path.c_str());
+        close();
+        return false;
+    }
+
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        ROS_ERROR("Cannot map capture file %s: %s",
+                  path.c_str(), strerror(errno));
+        close();
+        return false;
+    }
+    (void) madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    map = static_cast<uint8_t*>(addr);
+    map_size = st.st_size;
+
+    const CaptureHeader* header = reinterpret_cast<const CaptureHeader*>(map);
+    if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != CAPTURE_VERSION ||
+            header->record_size != sizeof(CaptureRecord) ||
+            header->index_interval == 0 ||
+            header->records_offset > map_size ||
+            header->index_offset + (header->capacity / header->index_interval + 1) *
+            sizeof(CaptureIndexEntry) > header->records_offset) {
+        ROS_ERROR("%s is not a version %u capture file",
+                  path.c_str(), CAPTURE_VERSION);
+        close();
+        return false;
+    }
+
+    // A recorder that died never shrank the file, trust the count,
+    // but never read past the end of the file.
+    index = reinterpret_cast<const CaptureIndexEntry*>(map + header->index_offset);
+    records = reinterpret_cast<const CaptureRecord*>(map + header->records_offset);
+    index_interval = header->index_interval;
+    count = std::min<uint64_t>(header->count,
+                (map_size - header->records_offset) / sizeof(CaptureRecord));
+    return true;
+}
+
+void CaptureReader::close() {
+    if (map != NULL)
+        (void) munmap(map, map_size);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    map = NULL;
+    map_size = 0;
+    index = NULL;
+    records = NULL;
+    count = 0;
+}
+
+uint64_t CaptureReader::find(const ros::Time& stamp) const {
+    // Find the last index entry before stamp, then walk its records.
+    uint64_t lo = 0;
+    uint64_t hi = (count + index_interval - 1) / index_interval;
+    while (lo < hi) {
+        const uint64_t mid = (lo + hi) / 2;
+        if (ros::Time(index[mid].sec, index[mid].nsec) < stamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    uint64_t i = lo > 0 ? (lo - 1) * index_interval : 0;
+    while (i < count && this->stamp(i) < stamp)
+        ++i;
+    return i;
+}
+
+} // namespace lslidar_c16_driver
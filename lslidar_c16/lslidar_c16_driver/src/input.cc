@@ -0,0 +1,674 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/net_tstamp.h>
+
+#include <lslidar_c16_driver/input.h>
+
+namespace lslidar_c16_driver {
+
+// Room for one SCM_TIMESTAMPING message (three timespecs) and one
+// SO_RXQ_OVFL drop count per datagram.
+static const size_t CONTROL_SIZE =
+        CMSG_SPACE(3 * sizeof(timespec)) + CMSG_SPACE(sizeof(uint32_t));
+
+// Kernel memory charged per queued datagram, including the buffer the
+// driver of the network card received it into.
+static const int RECEIVE_BUFFER_PER_PACKET = 2304;
+
+InputSocket::InputSocket():
+    socket_id(-1),
+    filter_ip(false),
+    timestamp_mode(TIMESTAMP_GPS),
+    batch_size(1),
+    batch_count(0),
+    batch_index(0),
+    drained(false),
+    drops(0),
+    last_drop_count(0) {
+    return;
+}
+
+InputSocket::~InputSocket() {
+    if (socket_id != -1)
+        (void) close(socket_id);
+}
+
+bool InputSocket::enableTimestamping() {
+    if (timestamp_mode == TIMESTAMP_KERNEL) {
+        int enable = 1;
+        if (setsockopt(socket_id, SOL_SOCKET, SO_TIMESTAMPNS,
+                       &enable, sizeof(enable)) < 0) {
+            perror("SO_TIMESTAMPNS");
+            return false;
+        }
+        return true;
+    }
+
+    // Ask for both the raw NIC stamp and the software stamp, so that
+    // packets still carry a kernel time when the interface cannot
+    // timestamp in hardware. Hardware stamps are only generated once
+    // the NIC has been configured, e.g. with hwstamp_ctl.
+    int flags = SOF_TIMESTAMPING_RX_HARDWARE |
+            SOF_TIMESTAMPING_RAW_HARDWARE |
+            SOF_TIMESTAMPING_RX_SOFTWARE |
+            SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(socket_id, SOL_SOCKET, SO_TIMESTAMPING,
+                   &flags, sizeof(flags)) < 0) {
+        perror("SO_TIMESTAMPING");
+        return false;
+    }
+    return true;
+}
+
+/** @brief Make room for packets datagrams in the socket buffer.
+ *
+ *  SO_RCVBUF is capped at net.core.rmem_max, SO_RCVBUFFORCE is not
+ *  but needs CAP_NET_ADMIN. The kernel doubles the requested value
+ *  for its bookkeeping.
+ */
+void InputSocket::setReceiveBuffer(int packets) {
+    const int needed = packets * RECEIVE_BUFFER_PER_PACKET;
+    int size = needed / 2;
+    if (setsockopt(socket_id, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+        (void) setsockopt(socket_id, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    socklen_t length = sizeof(size);
+    if (getsockopt(socket_id, SOL_SOCKET, SO_RCVBUF, &size, &length) < 0) {
+        perror("SO_RCVBUF");
+        return;
+    }
+    if (size < needed)
+        ROS_WARN("Socket buffer of %d bytes holds %d of %d packets, "
+                 "raise net.core.rmem_max to at least %d",
+                 size, size / RECEIVE_BUFFER_PER_PACKET, packets, needed / 2);
+    else
+        ROS_INFO("Socket buffer of %d bytes for %d packets", size, packets);
+    return;
+}
+
+bool InputSocket::open(int port, const std::string& lidar_ip_string,
+                       const std::string& group_ip_string, int size,
+                       TimestampMode mode, int buffer_packets) {
+    filter_ip = !lidar_ip_string.empty();
+    if (filter_ip)
+        inet_aton(lidar_ip_string.c_str(), &lidar_ip);
+    batch_size = size;
+    timestamp_mode = mode;
+
+    socket_id = socket(PF_INET, SOCK_DGRAM, 0);
+    if (socket_id == -1) {
+        perror("socket");
+        return false;
+    }
+
+    sockaddr_in my_addr;                     // my address information
+    memset(&my_addr, 0, sizeof(my_addr));    // initialize to zeros
+    my_addr.sin_family = AF_INET;            // host byte order
+    my_addr.sin_port = htons(port);          // short, in network byte order
+    ROS_INFO_STREAM("Opening UDP socket: port " << port);
+    my_addr.sin_addr.s_addr = INADDR_ANY;    // automatically fill in my IP
+
+    if (bind(socket_id, (sockaddr *)&my_addr, sizeof(sockaddr)) == -1) {
+        perror("bind");                 // TODO: ROS_ERROR errno
+        return false;
+    }
+    //add multicast
+    if (!group_ip_string.empty()) {
+        ip_mreq groupcast;
+        groupcast.imr_interface.s_addr=INADDR_ANY;
+        groupcast.imr_multiaddr.s_addr=inet_addr(group_ip_string.c_str());
+
+        if(setsockopt(socket_id,IPPROTO_IP,IP_ADD_MEMBERSHIP,(char*)&groupcast,sizeof(groupcast))<0) {
+            perror("set multicast error");
+            close(socket_id);
+            socket_id = -1;
+            return false;
+        }
+    }
+    if (fcntl(socket_id, F_SETFL, O_NONBLOCK|FASYNC) < 0) {
+        perror("non-block");
+        return false;
+    }
+    if (buffer_packets > 0)
+        setReceiveBuffer(buffer_packets);
+
+    if (timestamp_mode != TIMESTAMP_GPS && !enableTimestamping()) {
+        ROS_WARN("Kernel timestamping unavailable, using the GPS timestamp");
+        timestamp_mode = TIMESTAMP_GPS;
+    }
+
+    // Have the kernel tell how many datagrams it dropped because the
+    // socket buffer was full.
+    int enable = 1;
+    if (setsockopt(socket_id, SOL_SOCKET, SO_RXQ_OVFL,
+                   &enable, sizeof(enable)) < 0)
+        ROS_WARN("SO_RXQ_OVFL unavailable, socket drops are not counted");
+
+    // Preallocate the receive ring. Each slot gets its own packet
+    // buffer, sender address and control buffer so that one
+    // recvmmsg() call can drain every datagram queued on the socket.
+    batch_buffer.assign(batch_size * MAX_PACKET_SIZE, 0);
+    batch_msgs.assign(batch_size, mmsghdr());
+    batch_iovecs.assign(batch_size, iovec());
+    batch_addrs.assign(batch_size, sockaddr_in());
+    batch_control.assign(batch_size * CONTROL_SIZE, 0);
+    for (int i = 0; i < batch_size; ++i) {
+        batch_iovecs[i].iov_base = &batch_buffer[i * MAX_PACKET_SIZE];
+        batch_iovecs[i].iov_len = MAX_PACKET_SIZE;
+        batch_msgs[i].msg_hdr.msg_iov = &batch_iovecs[i];
+        batch_msgs[i].msg_hdr.msg_iovlen = 1;
+        batch_msgs[i].msg_hdr.msg_name = &batch_addrs[i];
+        batch_msgs[i].msg_hdr.msg_control = &batch_control[i * CONTROL_SIZE];
+    }
+    batch_count = 0;
+    batch_index = 0;
+
+    return true;
+}
+
+int InputSocket::receivePackets() {
+    // The kernel overwrites msg_namelen with the actual address
+    // length, so it has to be reset before every call.
+    for (int i = 0; i < batch_size; ++i) {
+        batch_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        batch_msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+    }
+
+    batch_count = 0;
+    batch_index = 0;
+
+    int nmsgs = recvmmsg(socket_id, &batch_msgs[0], batch_size,
+                         MSG_DONTWAIT, NULL);
+    if (nmsgs < 0)
+    {
+        if (errno != EWOULDBLOCK && errno != EAGAIN)
+        {
+            perror("recvfail");
+            ROS_INFO("recvfail");
+            return -1;
+        }
+        return 0;
+    }
+
+    batch_count = nmsgs;
+    return nmsgs;
+}
+
+// The raw hardware stamp is in the time base of the NIC clock, which
+// only matches the system clock when it is synced, e.g. by phc2sys.
+static const double MAX_HARDWARE_STAMP_OFFSET = 0.01;   // [s]
+
+bool InputSocket::hardwareStampUsable(
+        const timespec& hardware, const timespec& software) {
+    if (hardware.tv_sec == 0 && hardware.tv_nsec == 0)
+        return false;
+    if (software.tv_sec == 0 && software.tv_nsec == 0)
+        return true;
+
+    const double offset = (hardware.tv_sec - software.tv_sec) +
+            (hardware.tv_nsec - software.tv_nsec) * 1e-9;
+    if (fabs(offset) <= MAX_HARDWARE_STAMP_OFFSET)
+        return true;
+    ROS_WARN_THROTTLE(10, "NIC clock is %.3f s off the system clock, using "
+                      "software receive stamps (sync it with phc2sys)", offset);
+    return false;
+}
+
+bool InputSocket::parseControl(
+        const msghdr& hdr, ros::Time& stamp) {
+    bool have_stamp = false;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&hdr), cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+
+        const timespec* ts = NULL;
+        if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+            // The socket's running drop count, only sent once it is
+            // non-zero. It wraps at 32 bits.
+            uint32_t count;
+            memcpy(&count, CMSG_DATA(cmsg), sizeof(count));
+            drops += static_cast<uint32_t>(count - last_drop_count);
+            last_drop_count = count;
+        } else if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            ts = reinterpret_cast<const timespec*>(CMSG_DATA(cmsg));
+        } else if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            // ts[0] is the software stamp, ts[2] the raw hardware one.
+            const timespec* stamps =
+                    reinterpret_cast<const timespec*>(CMSG_DATA(cmsg));
+            ts = hardwareStampUsable(stamps[2], stamps[0]) ?
+                        &stamps[2] : &stamps[0];
+        }
+
+        if (ts != NULL && (ts->tv_sec != 0 || ts->tv_nsec != 0)) {
+            stamp = ros::Time(ts->tv_sec, ts->tv_nsec);
+            have_stamp = true;
+        }
+    }
+    return have_stamp;
+}
+
+bool InputSocket::takeReceivedPacket(
+        const uint8_t*& data, ros::Time& stamp) {
+    while (batch_index < batch_count)
+    {
+        const int idx = batch_index++;
+        // Datagrams longer than a slot come truncated.
+        const uint8_t* packet = &batch_buffer[idx * MAX_PACKET_SIZE];
+        if ((batch_msgs[idx].msg_hdr.msg_flags & MSG_TRUNC) ||
+                findPacketFormat(packet, batch_msgs[idx].msg_len) == NULL)
+            continue;
+
+        // if packet is not from the lidar scanner we selected by IP,
+        // continue otherwise we are done
+        if (filter_ip &&
+                batch_addrs[idx].sin_addr.s_addr != lidar_ip.s_addr)
+            continue;
+
+        data = packet;
+        if (!parseControl(batch_msgs[idx].msg_hdr, stamp) ||
+                timestamp_mode == TIMESTAMP_GPS)
+            stamp = ros::Time();
+        return true;
+    }
+    return false;
+}
+
+bool InputSocket::takePacket(const uint8_t*& data, ros::Time& stamp) {
+    while (true)
+    {
+        if (takeReceivedPacket(data, stamp))
+            return true;
+
+        // A partially filled ring means the socket queue is empty.
+        if (drained)
+        {
+            drained = false;
+            return false;
+        }
+
+        const int nmsgs = receivePackets();
+        if (nmsgs <= 0)
+            return false;
+        drained = nmsgs < batch_size;
+    }
+}
+
+int InputSocket::getPacket(const uint8_t*& data, ros::Time& stamp) {
+
+    struct pollfd fds[1];
+    fds[0].fd = socket_id;
+    fds[0].events = POLLIN;
+    static const int POLL_TIMEOUT = 2000; // one second (in msec)
+
+    while (true)
+    {
+        // Hand out the datagrams left over from the last recvmmsg()
+        // before going back to the socket.
+        if (takeReceivedPacket(data, stamp))
+            return 0;
+
+        // Unfortunately, the Linux kernel recvfrom() implementation
+        // uses a non-interruptible sleep() when waiting for data,
+        // which would cause this method to hang if the device is not
+        // providing data.  We poll() the device first to make sure
+        // the recvfrom() will not block.
+        //
+        // Note, however, that there is a known Linux kernel bug:
+        //
+        //   Under Linux, select() may report a socket file descriptor
+        //   as "ready for reading", while nevertheless a subsequent
+        //   read blocks.  This could for example happen when data has
+        //   arrived but upon examination has wrong checksum and is
+        //   discarded.  There may be other circumstances in which a
+        //   file descriptor is spuriously reported as ready.  Thus it
+        //   may be safer to use O_NONBLOCK on sockets that should not
+        //   block.
+
+        // poll() until input available
+        do {
+            int retval = poll(fds, 1, POLL_TIMEOUT);
+            if (retval < 0)             // poll() error?
+            {
+                if (errno != EINTR)
+                    ROS_ERROR("poll() error: %s", strerror(errno));
+                return 1;
+            }
+            if (retval == 0)            // poll() timeout?
+            {
+                ROS_WARN("lslidar poll() timeout");
+                return 1;
+            }
+            if ((fds[0].revents & POLLERR)
+                    || (fds[0].revents & POLLHUP)
+                    || (fds[0].revents & POLLNVAL)) // device error?
+            {
+                ROS_ERROR("poll() reports lslidar error");
+                return 1;
+            }
+        } while ((fds[0].revents & POLLIN) == 0);
+
+        // Drain every datagram that is now available from the
+        // socket with a single non-blocking recvmmsg().
+        if (receivePackets() < 0)
+            return 1;
+    }
+}
+
+InputFile::InputFile(double r, bool l):
+    rate(r),
+    loop(l),
+    started(false),
+    pending(false),
+    pending_data(NULL) {
+    return;
+}
+
+bool InputFile::fetch() {
+    if (pending)
+        return true;
+
+    if (!next(pending_data, pending_stamp)) {
+        if (!loop)
+            return false;
+        rewind();
+        started = false;
+        if (!next(pending_data, pending_stamp))
+            return false;
+    }
+
+    // Pace the packets relative to the first one handed out.
+    if (!started) {
+        file_start = pending_stamp;
+        wall_start = ros::WallTime::now();
+        started = true;
+    }
+    pending = true;
+    return true;
+}
+
+ros::WallTime InputFile::dueTime() const {
+    return wall_start + ros::WallDuration(
+                (pending_stamp - file_start).toSec() / rate);
+}
+
+int InputFile::getPacket(const uint8_t*& data, ros::Time& stamp) {
+    if (!fetch())
+        return -1;
+
+    if (rate > 0.0) {
+        // Sleep at most a second at a time, so that a long gap in the
+        // recording does not hold up a shut down.
+        const ros::WallDuration wait = dueTime() - ros::WallTime::now();
+        if (wait > ros::WallDuration(1.0)) {
+            ros::WallDuration(1.0).sleep();
+            return 1;
+        }
+        if (wait > ros::WallDuration(0.0))
+            wait.sleep();
+    }
+
+    data = pending_data;
+    stamp = pending_stamp;
+    pending = false;
+    return 0;
+}
+
+bool InputFile::takePacket(const uint8_t*& data, ros::Time& stamp) {
+    if (!fetch())
+        return false;
+    if (rate > 0.0 && dueTime() > ros::WallTime::now())
+        return false;
+
+    data = pending_data;
+    stamp = pending_stamp;
+    pending = false;
+    return true;
+}
+
+// pcap magic numbers, as read on this host.
+static const uint32_t PCAP_MAGIC = 0xa1b2c3d4;
+static const uint32_t PCAP_MAGIC_NS = 0xa1b23c4d;
+static const uint32_t PCAP_MAGIC_SWAPPED = 0xd4c3b2a1;
+static const uint32_t PCAP_MAGIC_NS_SWAPPED = 0x4d3cb2a1;
+static const size_t PCAP_HEADER_SIZE = 24;
+static const size_t PCAP_RECORD_SIZE = 16;
+
+static const uint32_t LINKTYPE_ETHERNET = 1;
+static const uint32_t LINKTYPE_LINUX_SLL = 113;
+
+// The UDP payload of an Ethernet or Linux cooked frame, NULL if the
+// frame is not an IPv4/UDP datagram.
+static const uint8_t* udpPayload(const uint8_t* frame, size_t len,
+                                 uint32_t link_type, size_t& payload_len,
+                                 in_addr& source, uint16_t& port) {
+    size_t offset;
+    uint16_t ether_type;
+    if (link_type == LINKTYPE_ETHERNET) {
+        if (len < 14) return NULL;
+        ether_type = (frame[12] << 8) | frame[13];
+        offset = 14;
+        if (ether_type == 0x8100 && len >= 18) {
+            ether_type = (frame[16] << 8) | frame[17];
+            offset = 18;
+        }
+    } else if (link_type == LINKTYPE_LINUX_SLL) {
+        if (len < 16) return NULL;
+        ether_type = (frame[14] << 8) | frame[15];
+        offset = 16;
+    } else {
+        return NULL;
+    }
+    if (ether_type != 0x0800 || len < offset + 20) return NULL;
+
+    const uint8_t* ip = frame + offset;
+    const size_t ip_header = (ip[0] & 0x0f) * 4;
+    if (ip[9] != 17 || len < offset + ip_header + 8) return NULL;
+
+    const uint8_t* udp = ip + ip_header;
+    memcpy(&source.s_addr, ip + 12, 4);
+    port = (udp[2] << 8) | udp[3];
+    payload_len = len - offset - ip_header - 8;
+    return udp + 8;
+}
+
+InputPCAP::InputPCAP(double rate, bool loop):
+    InputFile(rate, loop),
+    map(NULL),
+    map_size(0),
+    offset(PCAP_HEADER_SIZE),
+    swapped(false),
+    nanoseconds(false),
+    link_type(0),
+    filter_ip(false),
+    port(0) {
+    return;
+}
+
+InputPCAP::~InputPCAP() {
+    if (map != NULL)
+        (void) munmap(map, map_size);
+}
+
+uint32_t InputPCAP::readU32(const uint8_t* p) const {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swapped ? __builtin_bswap32(v) : v;
+}
+
+bool InputPCAP::open(const std::string& path,
+                     const std::string& lidar_ip_string, int udp_port) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ROS_ERROR("Cannot open pcap file %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+            static_cast<size_t>(st.st_size) < PCAP_HEADER_SIZE) {
+        ROS_ERROR("%s is not a pcap file", path.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping outlives the descriptor.
+    void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        ROS_ERROR("Cannot map pcap file %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    (void) madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    map = static_cast<uint8_t*>(addr);
+    map_size = st.st_size;
+
+    uint32_t magic;
+    memcpy(&magic, map, 4);
+    swapped = magic == PCAP_MAGIC_SWAPPED || magic == PCAP_MAGIC_NS_SWAPPED;
+    nanoseconds = magic == PCAP_MAGIC_NS || magic == PCAP_MAGIC_NS_SWAPPED;
+    if (!swapped && magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS) {
+        ROS_ERROR("%s is not a pcap file", path.c_str());
+        return false;
+    }
+
+    link_type = readU32(map + 20);
+    if (link_type != LINKTYPE_ETHERNET && link_type != LINKTYPE_LINUX_SLL) {
+        ROS_ERROR("%s has unsupported link type %u", path.c_str(), link_type);
+        return false;
+    }
+
+    filter_ip = !lidar_ip_string.empty();
+    if (filter_ip)
+        inet_aton(lidar_ip_string.c_str(), &lidar_ip);
+    port = udp_port;
+    offset = PCAP_HEADER_SIZE;
+    return true;
+}
+
+bool InputPCAP::next(const uint8_t*& data, ros::Time& stamp) {
+    while (offset + PCAP_RECORD_SIZE <= map_size) {
+        const uint8_t* record = map + offset;
+        const uint32_t sec = readU32(record);
+        const uint32_t frac = readU32(record + 4);
+        const uint32_t len = readU32(record + 8);
+        if (offset + PCAP_RECORD_SIZE + len > map_size)
+            break;                      // truncated by the capture
+        offset += PCAP_RECORD_SIZE + len;
+
+        size_t payload_len = 0;
+        in_addr source;
+        uint16_t dest_port = 0;
+        const uint8_t* payload = udpPayload(record + PCAP_RECORD_SIZE, len,
+                                            link_type, payload_len,
+                                            source, dest_port);
+        if (payload == NULL || findPacketFormat(payload, payload_len) == NULL)
+            continue;
+        if (filter_ip && source.s_addr != lidar_ip.s_addr)
+            continue;
+        if (port != 0 && dest_port != port)
+            continue;
+
+        data = payload;
+        stamp = ros::Time(sec, nanoseconds ? frac : frac * 1000);
+        return true;
+    }
+    return false;
+}
+
+void InputPCAP::rewind() {
+    offset = PCAP_HEADER_SIZE;
+}
+
+InputCapture::InputCapture(double rate, bool loop):
+    InputFile(rate, loop),
+    index(0) {
+    return;
+}
+
+bool InputCapture::open(const std::string& path) {
+    index = 0;
+    return capture.open(path);
+}
+
+bool InputCapture::next(const uint8_t*& data, ros::Time& stamp) {
+    if (index >= capture.size())
+        return false;
+    data = capture.packet(index);
+    stamp = capture.stamp(index);
+    ++index;
+    return true;
+}
+
+void InputCapture::rewind() {
+    index = 0;
+}
+
+InputFileType detectInputFile(const std::string& path) {
+    uint8_t magic[8];
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return INPUT_FILE_UNKNOWN;
+    const size_t len = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+
+    uint32_t m = 0;
+    if (len >= 4)
+        memcpy(&m, magic, 4);
+    if (m == PCAP_MAGIC || m == PCAP_MAGIC_NS ||
+            m == PCAP_MAGIC_SWAPPED || m == PCAP_MAGIC_NS_SWAPPED)
+        return INPUT_FILE_PCAP;
+    if (len == sizeof(magic) &&
+            memcmp(magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) == 0)
+        return INPUT_FILE_CAPTURE;
+    return INPUT_FILE_UNKNOWN;
+}
+
+InputPtr openInputFile(const std::string& path, double rate, bool loop,
+                       const std::string& lidar_ip, int port) {
+    switch (detectInputFile(path)) {
+    case INPUT_FILE_PCAP: {
+        boost::shared_ptr<InputPCAP> input(new InputPCAP(rate, loop));
+        if (input->open(path, lidar_ip, port))
+            return input;
+        break;
+    }
+    case INPUT_FILE_CAPTURE: {
+        boost::shared_ptr<InputCapture> input(new InputCapture(rate, loop));
+        if (input->open(path))
+            return input;
+        break;
+    }
+    default:
+        ROS_ERROR("Cannot read %s as a pcap or capture file", path.c_str());
+        break;
+    }
+    return InputPtr();
+}
+
+} // namespace lslidar_c16_driver
@@ -17,13 +17,11 @@
 
 #include <string>
 #include <cmath>
+#include <cstring>
 #include <unistd.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <poll.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <sys/file.h>
+#include <time.h>
 
 #include <ros/ros.h>
 #include <tf/transform_listener.h>
@@ -32,16 +30,47 @@
 
 namespace lslidar_c16_driver {
 
+// c16 publishs 20*16 thousands points per second.
+// Each packet contains 12 blocks. And each block
+// contains 32 points. Together provides the
+// packet rate in the single return mode.
+static const double NOMINAL_PACKET_RATE = 16*20000.0 / (12*32);
+
+// The dual return mode sends both returns of every firing.
+static const double MAX_PACKET_RATE = 2 * NOMINAL_PACKET_RATE;
+
+// Azimuth advance between two packets beyond which packets were lost
+// [0.01 degree]. At 20 Hz a packet covers about 8.6 degrees.
+static const int MAX_PACKET_ADVANCE = 1500;
+
 LslidarC16Driver::LslidarC16Driver(
         ros::NodeHandle& n, ros::NodeHandle& pn):
     nh(n),
     pnh(pn),
-    socket_id(-1){
+    timestamp_mode(TIMESTAMP_GPS),
+    batch_size(1),
+    socket_buffer_time(0.0),
+    input_rate(1.0),
+    input_loop(false),
+    packet_pool_size(0),
+    record_packets(0),
+    frequency(10.0),
+    last_rotation(-1),
+    rotation_advance(0),
+    steady_advance(0),
+    steady_packets(0),
+    diag_rotation_advance(0),
+    diag_steady_advance(0),
+    diag_steady_packets(0),
+    statistics_period(0.0),
+    packets_received(statistics.addCounter("packets")),
+    socket_drops(statistics.addCounter("socket drops")),
+    receive_latency(statistics.addHistogram("receive to publish", "us")),
+    diag_socket_drops(0){
     return;
 }
 
 LslidarC16Driver::~LslidarC16Driver() {
-    (void) close(socket_id);
     return;
 }
 
@@ -52,10 +81,46 @@ bool LslidarC16Driver::loadParameters() {
   pnh.param<int>("device_port", UDP_PORT_NUMBER,2368);
   pnh.param<bool>("add_multicast", add_multicast, false);
   pnh.param("group_ip", group_ip_string, std::string("234.2.3.2"));
-  inet_aton(lidar_ip_string.c_str(), &lidar_ip);
-  ROS_INFO_STREAM("Opening UDP socket: address " << lidar_ip_string);
-  if(add_multicast) ROS_INFO_STREAM("Opening UDP socket: group_address " << group_ip_string);
-  ROS_INFO_STREAM("Opening UDP socket: port " << UDP_PORT_NUMBER);
+  pnh.param<int>("batch_size", batch_size, 32);
+  if (batch_size < 1) batch_size = 1;
+  pnh.param<double>("socket_buffer_time", socket_buffer_time, 0.2);
+  pnh.param<double>("frequency", frequency, 10.0);
+  if (frequency <= 0.0) {
+    ROS_ERROR("frequency must be positive");
+    return false;
+  }
+  pnh.param<int>("packet_pool_size", packet_pool_size, 0);
+  if (packet_pool_size < 0) packet_pool_size = 0;
+  packet_pool.resize(packet_pool_size);
+  pnh.param("input_file", input_file, std::string(""));
+  pnh.param<double>("input_rate", input_rate, 1.0);
+  pnh.param<bool>("input_loop", input_loop, false);
+  pnh.param("record_file", record_file, std::string(""));
+  pnh.param<int>("record_packets", record_packets, 3000000);
+  if (record_packets < 1) record_packets = 1;
+  pnh.param<double>("statistics_period", statistics_period, 0.0);
+  pnh.param("timestamp_mode", timestamp_mode_string, std::string("gps"));
+  if (timestamp_mode_string == "gps") {
+    timestamp_mode = TIMESTAMP_GPS;
+  } else if (timestamp_mode_string == "kernel") {
+    timestamp_mode = TIMESTAMP_KERNEL;
+  } else if (timestamp_mode_string == "hardware") {
+    timestamp_mode = TIMESTAMP_HARDWARE;
+  } else {
+    ROS_ERROR_STREAM("Unknown timestamp_mode " << timestamp_mode_string
+                     << ", expected gps, kernel or hardware");
+    return false;
+  }
+  if (!input_file.empty()) {
+    ROS_INFO_STREAM("Reading packets from " << input_file << " at rate " << input_rate);
+  } else {
+    ROS_INFO_STREAM("Opening UDP socket: address " << lidar_ip_string);
+    if(add_multicast) ROS_INFO_STREAM("Opening UDP socket: group_address " << group_ip_string);
+    ROS_INFO_STREAM("Receiving up to " << batch_size << " packets per recvmmsg()");
+  }
+  ROS_INFO_STREAM("Packet timestamp mode: " << timestamp_mode_string);
+  if (packet_pool_size > 0)
+    ROS_INFO_STREAM("Recycling packets from a pool of " << packet_pool_size);
   return true;
 }
 
@@ -63,11 +128,9 @@ bool LslidarC16Driver::createRosIO() {
 
   // ROS diagnostics
   diagnostics.setHardwareID("Lslidar_C16");
-  // c16 publishs 20*16 thousands points per second.
-  // Each packet contains 12 blocks. And each block
-  // contains 32 points. Together provides the
-  // packet rate.
-  const double diag_freq = 16*20000.0 / (12*32);
+  // Start from the nominal packet rate, rateDiagnostics() replaces it
+  // once the packets tell how many of them make a revolution.
+  const double diag_freq = NOMINAL_PACKET_RATE;
   diag_max_freq = diag_freq;
   diag_min_freq = diag_freq;
   ROS_INFO("expected frequency: %.3f (Hz)", diag_freq);
@@ -78,47 +141,17 @@ bool LslidarC16Driver::createRosIO() {
                          FrequencyStatusParam(&diag_min_freq, &diag_max_freq, 0.1, 10),
                          TimeStampStatusParam()));
 
+    diagnostics.add("driver statistics", boost::bind(
+        &LslidarC16Driver::statisticsDiagnostics, this, _1));
+    diagnostics.add("sensor rate", boost::bind(
+        &LslidarC16Driver::rateDiagnostics, this, _1));
+    diag_rate_time = ros::WallTime::now();
+
     // Output
     packet_pub = nh.advertise<lslidar_c16_msgs::LslidarC16Packet>(
                 "lslidar_packet", 100);
-    return true;
-}
-
-bool LslidarC16Driver::openUDPPort() {
-    socket_id = socket(PF_INET, SOCK_DGRAM, 0);
-    if (socket_id == -1) {
-        perror("socket");
-        return false;
-    }
-
-    sockaddr_in my_addr;                     // my address information
-    memset(&my_addr, 0, sizeof(my_addr));    // initialize to zeros
-    my_addr.sin_family = AF_INET;            // host byte order
-    my_addr.sin_port = htons(UDP_PORT_NUMBER);      // short, in network byte order
-  ROS_INFO_STREAM("Opening UDP socket: port " << UDP_PORT_NUMBER);
-    my_addr.sin_addr.s_addr = INADDR_ANY;    // automatically fill in my IP
-
-    if (bind(socket_id, (sockaddr *)&my_addr, sizeof(sockaddr)) == -1) {
-        perror("bind");                 // TODO: ROS_ERROR errno
-        return false;
-    }
-    //add multicast
-	if(add_multicast){
-       ip_mreq groupcast;
-       groupcast.imr_interface.s_addr=INADDR_ANY;
-       groupcast.imr_multiaddr.s_addr=inet_addr(group_ip_string.c_str());
-    
-       if(setsockopt(socket_id,IPPROTO_IP,IP_ADD_MEMBERSHIP,(char*)&groupcast,sizeof(groupcast))<0) {
-          perror("set multicast error");
-          close(socket_id);
-          return false;
-       }
-	}
-    if (fcntl(socket_id, F_SETFL, O_NONBLOCK|FASYNC) < 0) {
-        perror("non-block");
-        return false;
-    }
-
+    statistics_pub.start(statistics, nh, "lslidar_driver_statistics",
+                         "driver", statistics_period);
     return true;
 }
 
@@ -136,116 +169,106 @@ bool LslidarC16Driver::initialize() {
         return false;
     }
 
-    if (!openUDPPort()) {
-        ROS_ERROR("Cannot open UDP port...");
+    if (!openInput()) {
+        ROS_ERROR("Cannot open the packet input...");
+        return false;
+    }
+
+    if (!record_file.empty() && !openRecorder()) {
+        ROS_ERROR("Cannot open the capture file...");
         return false;
     }
     ROS_INFO("Initialised lslidar c16 without error");
     return true;
 }
 
-int LslidarC16Driver::getPacket(
+bool LslidarC16Driver::takePacket(
         lslidar_c16_msgs::LslidarC16PacketPtr& packet) {
+    const uint8_t* data;
+    if (!takeRawPacket(data, packet->stamp))
+        return false;
+    memcpy(&packet->data[0], data, MAX_PACKET_SIZE);
+    return true;
+}
 
-    double time1 = ros::Time::now().toSec();
-
-    struct pollfd fds[1];
-    fds[0].fd = socket_id;
-    fds[0].events = POLLIN;
-  static const int POLL_TIMEOUT = 2000; // one second (in msec)
-
-    sockaddr_in sender_address;
-    socklen_t sender_address_len = sizeof(sender_address);
-
-    while (true)
-    {
-        // Unfortunately, the Linux kernel recvfrom() implementation
-        // uses a non-interruptible sleep() when waiting for data,
-        // which would cause this method to hang if the device is not
-        // providing data.  We poll() the device first to make sure
-        // the recvfrom() will not block.
-        //
-        // Note, however, that there is a known Linux kernel bug:
-        //
-        //   Under Linux, select() may report a socket file descriptor
-        //   as "ready for reading", while nevertheless a subsequent
-        //   read blocks.  This could for example happen when data has
-        //   arrived but upon examination has wrong checksum and is
-        //   discarded.  There may be other circumstances in which a
-        //   file descriptor is spuriously reported as ready.  Thus it
-        //   may be safer to use O_NONBLOCK on sockets that should not
-        //   block.
-
-        // poll() until input available
-        do {
-            int retval = poll(fds, 1, POLL_TIMEOUT);
-            if (retval < 0)             // poll() error?
-            {
-                if (errno != EINTR)
-                    ROS_ERROR("poll() error: %s", strerror(errno));
-                return 1;
-            }
-            if (retval == 0)            // poll() timeout?
-            {
-                ROS_WARN("lslidar poll() timeout");
-                return 1;
-            }
-            if ((fds[0].revents & POLLERR)
-                    || (fds[0].revents & POLLHUP)
-                    || (fds[0].revents & POLLNVAL)) // device error?
-            {
-                ROS_ERROR("poll() reports lslidar error");
-                return 1;
-            }
-        } while ((fds[0].revents & POLLIN) == 0);
-
-        // Receive packets that should now be available from the
-        // socket using a blocking read.
-        ssize_t nbytes = recvfrom(socket_id, &packet->data[0], PACKET_SIZE,  0,
-                (sockaddr*) &sender_address, &sender_address_len);
+bool LslidarC16Driver::takeRawPacket(
+        const uint8_t*& data, ros::Time& stamp) {
+    if (!input->takePacket(data, stamp))
+        return false;
+    acceptPacket(data, stamp);
+    return true;
+}
 
-//        ROS_DEBUG_STREAM("incomplete lslidar packet read: "
-//                         << nbytes << " bytes");
+int LslidarC16Driver::getRawPacket(
+        const uint8_t*& data, ros::Time& stamp) {
+    int rc = input->getPacket(data, stamp);
+    if (rc == 0)
+        acceptPacket(data, stamp);
+    return rc;
+}
 
-        if (nbytes < 0)
-        {
-            if (errno != EWOULDBLOCK)
-            {
-                perror("recvfail");
-                ROS_INFO("recvfail");
-                return 1;
+void LslidarC16Driver::acceptPacket(
+        const uint8_t* data, ros::Time& stamp) {
+    packets_received.fetch_add(1, std::memory_order_relaxed);
+    socket_drops.store(input->getDrops(), std::memory_order_relaxed);
+
+    // The inputs only hand out packets in one of the PACKET_FORMATS.
+    const PacketFormat* format = findPacketFormat(data, MAX_PACKET_SIZE);
+    if (format != NULL)
+        this->getFPGA_GPSTimeStamp(data, *format);
+
+    // Follow the rotation with the azimuth of the first block.
+    if (format != NULL && format->data) {
+        const int rotation = data[2] | (data[3] << 8);
+        if (last_rotation >= 0) {
+            int advance = rotation - last_rotation;
+            if (advance < 0) advance += 36000;
+            rotation_advance.fetch_add(advance, std::memory_order_relaxed);
+            if (advance < MAX_PACKET_ADVANCE) {
+                steady_advance.fetch_add(advance, std::memory_order_relaxed);
+                steady_packets.fetch_add(1, std::memory_order_relaxed);
             }
         }
-        else if ((size_t) nbytes == PACKET_SIZE)
-        {
-            // read successful,
-            // if packet is not from the lidar scanner we selected by IP,
-            // continue otherwise we are done
-            if( lidar_ip_string != "" && sender_address.sin_addr.s_addr != lidar_ip.s_addr )
-                continue;
-            else
-                break; //done
-        }
+        last_rotation = rotation;
+    }
 
+    // Use the receive time of the input when it is available,
+    // otherwise fall back to the FPGA/GPS time.
+    if (timestamp_mode == TIMESTAMP_GPS || stamp.isZero())
+        stamp = this->timeStamp;
 
+    if (recorder && !recorder->append(data, stamp) &&
+            recorder->getDropped() == 1)
+        ROS_WARN("capture file %s is full, recording stopped",
+                 recorder->getPath().c_str());
+}
 
-    }
-    this->getFPGA_GPSTimeStamp(packet);
-
-    // Average the times at which we begin and end reading.  Use that to
-    // estimate when the scan occurred.
-    double time2 = ros::Time::now().toSec();
-//    packet->stamp = ros::Time((time2 + time1) / 2.0);
-    packet->stamp = this->timeStamp;
-    return 0;
+int LslidarC16Driver::getPacket(
+        lslidar_c16_msgs::LslidarC16PacketPtr& packet) {
+    const uint8_t* data;
+    int rc = getRawPacket(data, packet->stamp);
+    if (rc == 0)
+        memcpy(&packet->data[0], data, MAX_PACKET_SIZE);
+    return rc;
 }
 
-bool LslidarC16Driver::polling()
+int LslidarC16Driver::drainSocket()
 {
-    // Allocate a new shared pointer for zero-copy sharing with other nodelets.
-    lslidar_c16_msgs::LslidarC16PacketPtr packet(
-                new lslidar_c16_msgs::LslidarC16Packet());
+    int published = 0;
+    while (true)
+    {
+        lslidar_c16_msgs::LslidarC16PacketPtr packet = allocatePacket();
+        if (!takePacket(packet))
+            break;
+        publishPacket(packet);
+        ++published;
+    }
+    return published;
+}
 
+bool LslidarC16Driver::receivePacket(
+        lslidar_c16_msgs::LslidarC16PacketPtr& packet)
+{
     // Since the lslidar delivers data at a very high rate, keep
     // reading and publishing scans as fast as possible.
     //for (int i = 0; i < config_.npackets; ++i)
@@ -265,19 +288,187 @@ bool LslidarC16Driver::polling()
         if (rc == 0) break;       // got a full packet?
         if (rc < 0) return false; // end of file reached?
     }
+    return true;
+}
 
+void LslidarC16Driver::publishPacket(
+        const lslidar_c16_msgs::LslidarC16PacketPtr& packet)
+{
     // publish message using time of last packet read
+    // Publish through the shared pointer, so that nodelets in the
+    // same process receive this very message without a copy.
     ROS_DEBUG("Publishing a full lslidar scan.");
-    packet_pub.publish(*packet);
+    packet_pub.publish(packet);
+    tickDiagnostics(packet->stamp);
+}
+
+void LslidarC16Driver::tickDiagnostics(const ros::Time& stamp)
+{
+    // Only receive stamps tell how long the packet took to get here.
+    if (timestamp_mode != TIMESTAMP_GPS) {
+        const int64_t age = (ros::Time::now() - stamp).toNSec();
+        if (age >= 0)
+            receive_latency.add(age / 1000);
+    }
 
     // notify diagnostics that a message has been published, updating
     // its status
-    diag_topic->tick(packet->stamp);
+    diag_topic->tick(stamp);
     diagnostics.update();
+}
+
+uint32_t LslidarC16Driver::getNumPacketSubscribers() const
+{
+    return packet_pub.getNumSubscribers();
+}
+
+lslidar_c16_msgs::LslidarC16PacketPtr LslidarC16Driver::allocatePacket()
+{
+    if (packet_pool_size == 0)
+        return lslidar_c16_msgs::LslidarC16PacketPtr(
+                    new lslidar_c16_msgs::LslidarC16Packet());
+
+    // A pooled packet is only handed out again once every subscriber
+    // has released it, so it is never modified while still in use.
+    const size_t misses = packet_pool.getMisses();
+    lslidar_c16_msgs::LslidarC16PacketPtr packet = packet_pool.acquire();
+    if (packet_pool.getMisses() != misses)
+        ROS_WARN_THROTTLE(10, "packet pool exhausted %lu times, "
+                          "consider a larger packet_pool_size",
+                          packet_pool.getMisses());
+    return packet;
+}
+
+bool LslidarC16Driver::polling()
+{
+    // Allocate a new shared pointer for zero-copy sharing with other nodelets.
+    lslidar_c16_msgs::LslidarC16PacketPtr packet = allocatePacket();
+
+    if (!receivePacket(packet))
+        return false;
+
+    publishPacket(packet);
+    return true;
+}
+
+void LslidarC16Driver::addDiagnosticTask(
+        const std::string& name, const diagnostic_updater::TaskFunction& task)
+{
+    diagnostics.add(name, task);
+}
+
+bool LslidarC16Driver::openInput()
+{
+    if (!input_file.empty()) {
+        // A pcap file may hold the traffic of several lidars, keep the
+        // packets this driver would have received.
+        input = openInputFile(input_file, input_rate, input_loop,
+                              lidar_ip_string, UDP_PORT_NUMBER);
+        return input != NULL;
+    }
+
+    // Room for socket_buffer_time seconds of packets while the
+    // receive thread is not scheduled, at the highest packet rate.
+    const int buffer_packets = static_cast<int>(
+                std::ceil(socket_buffer_time * MAX_PACKET_RATE));
+    boost::shared_ptr<InputSocket> socket(new InputSocket());
+    if (!socket->open(UDP_PORT_NUMBER, lidar_ip_string,
+                      add_multicast ? group_ip_string : std::string(""),
+                      batch_size, timestamp_mode, buffer_packets))
+        return false;
+    input = socket;
+    return true;
+}
+
+bool LslidarC16Driver::openRecorder()
+{
+    // The file name may hold strftime() conversions, so that every
+    // run gets its own file.
+    char path[4096];
+    const time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    if (strftime(path, sizeof(path), record_file.c_str(), &local) == 0) {
+        ROS_ERROR_STREAM("Invalid record_file " << record_file);
+        return false;
+    }
 
+    recorder.reset(new CaptureWriter());
+    if (!recorder->open(path, record_packets)) {
+        recorder.reset();
+        return false;
+    }
+    ROS_INFO("Recording up to %d packets to %s", record_packets, path);
+    diagnostics.add("capture file", boost::bind(
+        &LslidarC16Driver::recorderDiagnostics, this, _1));
     return true;
 }
 
+void LslidarC16Driver::recorderDiagnostics(
+        diagnostic_updater::DiagnosticStatusWrapper& stat)
+{
+    const uint64_t dropped = recorder->getDropped();
+    if (dropped == 0)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "recording");
+    else
+        stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "capture file full");
+    stat.add("file", recorder->getPath());
+    stat.add("packets", recorder->size());
+    stat.add("capacity", recorder->capacity());
+    stat.add("dropped", dropped);
+}
+
+void LslidarC16Driver::statisticsDiagnostics(
+        diagnostic_updater::DiagnosticStatusWrapper& stat)
+{
+    const uint64_t drops = socket_drops.load(std::memory_order_relaxed);
+    if (drops == diag_socket_drops)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "no socket drops");
+    else
+        stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                     "packets dropped by the kernel, socket buffer too small");
+    diag_socket_drops = drops;
+    statistics.report(diag_statistics, stat);
+}
+
+void LslidarC16Driver::rateDiagnostics(
+        diagnostic_updater::DiagnosticStatusWrapper& stat)
+{
+    const ros::WallTime now = ros::WallTime::now();
+    const uint64_t advance = rotation_advance.load(std::memory_order_relaxed);
+    const uint64_t steady = steady_advance.load(std::memory_order_relaxed);
+    const uint64_t packets = steady_packets.load(std::memory_order_relaxed);
+    const double elapsed = (now - diag_rate_time).toSec();
+
+    stat.add("configured frequency [Hz]", frequency);
+    if (packets == diag_steady_packets || steady == diag_steady_advance || elapsed <= 0.0) {
+        stat.add("expected packet rate [Hz]", diag_min_freq);
+        stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "no rotation seen");
+        return;
+    }
+
+    // Follow the packet rate of the sensor, e.g. in the dual return
+    // mode, while the frequency diagnostic still catches lost packets.
+    const double rotation_rate = (advance - diag_rotation_advance) / 36000.0 / elapsed;
+    const double packets_per_revolution =
+            36000.0 * (packets - diag_steady_packets) / (steady - diag_steady_advance);
+    diag_min_freq = frequency * packets_per_revolution;
+    diag_max_freq = diag_min_freq;
+    diag_rate_time = now;
+    diag_rotation_advance = advance;
+    diag_steady_advance = steady;
+    diag_steady_packets = packets;
+
+    stat.add("expected packet rate [Hz]", diag_min_freq);
+    stat.add("rotation rate [rpm]", rotation_rate * 60.0);
+    stat.add("packets per revolution", packets_per_revolution);
+    if (fabs(rotation_rate - frequency) > 0.1 * frequency)
+        stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                     "rotation rate differs from frequency");
+    else
+        stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "rotating at frequency");
+}
+
 void LslidarC16Driver::initTimeStamp(void)
 {
     int i;
@@ -293,51 +484,63 @@ void LslidarC16Driver::initTimeStamp(void)
 
 void LslidarC16Driver::getFPGA_GPSTimeStamp(lslidar_c16_msgs::LslidarC16PacketPtr &packet)
 {
-    unsigned char head2[] = {packet->data[0],packet->data[1],packet->data[2],packet->data[3]};
+    getFPGA_GPSTimeStamp(&packet->data[0]);
+}
 
-    if(head2[0] == 0xA5 && head2[1] == 0xFF)
+void LslidarC16Driver::getFPGA_GPSTimeStamp(const uint8_t* data)
+{
+    const PacketFormat* format = findPacketFormat(data, MAX_PACKET_SIZE);
+    if (format != NULL)
+        getFPGA_GPSTimeStamp(data, *format);
+}
+
+void LslidarC16Driver::getFPGA_GPSTimeStamp(
+        const uint8_t* data, const PacketFormat& format)
+{
+    // The device packets carry the UTC time to the second, the data
+    // packets the microseconds within it.
+    if (format.utc_time_offset != 0)
     {
-        if(head2[2] == 0x00 && head2[3] == 0x5A)
+        const uint8_t* utc = data + format.utc_time_offset;
+        this->packetTimeStamp[4] = utc[5];
+        this->packetTimeStamp[5] = utc[4];
+        this->packetTimeStamp[6] = utc[3];
+        this->packetTimeStamp[7] = utc[2];
+        this->packetTimeStamp[8] = utc[1];
+        this->packetTimeStamp[9] = utc[0];
+
+        cur_time.tm_sec = this->packetTimeStamp[4];
+        cur_time.tm_min = this->packetTimeStamp[5];
+        cur_time.tm_hour = this->packetTimeStamp[6];
+        cur_time.tm_mday = this->packetTimeStamp[7];
+        cur_time.tm_mon = this->packetTimeStamp[8]-1;
+        cur_time.tm_year = this->packetTimeStamp[9]+2000-1900;
+        this->pointcloudTimeStamp = static_cast<uint64_t>(timegm(&cur_time));
+
+        if (GPSCountingTS != this->pointcloudTimeStamp)
         {
-            this->packetTimeStamp[4] = packet->data[41];
-            this->packetTimeStamp[5] = packet->data[40];
-            this->packetTimeStamp[6] = packet->data[39];
-            this->packetTimeStamp[7] = packet->data[38];
-            this->packetTimeStamp[8] = packet->data[37];
-            this->packetTimeStamp[9] = packet->data[36];
-
-            cur_time.tm_sec = this->packetTimeStamp[4];
-            cur_time.tm_min = this->packetTimeStamp[5];
-            cur_time.tm_hour = this->packetTimeStamp[6];
-            cur_time.tm_mday = this->packetTimeStamp[7];
-            cur_time.tm_mon = this->packetTimeStamp[8]-1;
-            cur_time.tm_year = this->packetTimeStamp[9]+2000-1900;
-            this->pointcloudTimeStamp = static_cast<uint64_t>(timegm(&cur_time));
-
-            if (GPSCountingTS != this->pointcloudTimeStamp)
-            {
-                cnt_gps_ts = 0;
-                GPSCountingTS = this->pointcloudTimeStamp;
-            }
-            else if (cnt_gps_ts == 3)
-            {
-                GPSStableTS = GPSCountingTS;
-            }
-            else
-            {
-                cnt_gps_ts ++;
-            }
-//            ROS_DEBUG("GPS: y:%d m:%d d:%d h:%d m:%d s:%d",
-//                      cur_time.tm_year,cur_time.tm_mon,cur_time.tm_mday,cur_time.tm_hour,cur_time.tm_min,cur_time.tm_sec);
+            cnt_gps_ts = 0;
+            GPSCountingTS = this->pointcloudTimeStamp;
+        }
+        else if (cnt_gps_ts == 3)
+        {
+            GPSStableTS = GPSCountingTS;
+        }
+        else
+        {
+            cnt_gps_ts ++;
         }
+//        ROS_DEBUG("GPS: y:%d m:%d d:%d h:%d m:%d s:%d",
+//                  cur_time.tm_year,cur_time.tm_mon,cur_time.tm_mday,cur_time.tm_hour,cur_time.tm_min,cur_time.tm_sec);
     }
-    else if(head2[0] == 0xFF && head2[1] == 0xEE)
+    else if (format.fpga_time_offset != 0)
     {
+        const uint8_t* fpga = data + format.fpga_time_offset;
         uint64_t packet_timestamp;
-        packet_timestamp = (packet->data[1200]  +
-                            packet->data[1201] * pow(2, 8) +
-                            packet->data[1202] * pow(2, 16) +
-                            packet->data[1203] * pow(2, 24)) * 1e3;
+        packet_timestamp = (fpga[0]  +
+                            fpga[1] * pow(2, 8) +
+                            fpga[2] * pow(2, 16) +
+                            fpga[3] * pow(2, 24)) * 1e3;
 
 
         if ((last_FPGA_ts - packet_timestamp) > 0)
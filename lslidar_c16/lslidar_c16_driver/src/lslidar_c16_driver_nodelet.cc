@@ -16,6 +16,9 @@
  */
 
 #include <string>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
 #include <boost/thread.hpp>
 
 #include <ros/ros.h>
@@ -29,7 +32,11 @@ namespace lslidar_c16_driver
 {
 
 LslidarC16DriverNodelet::LslidarC16DriverNodelet():
-  running(false) {
+  running(false),
+  two_stage(false),
+  receive_cpu(-1),
+  ring_overruns(0),
+  ring_depth(NULL) {
   return;
 }
 
@@ -38,6 +45,8 @@ LslidarC16DriverNodelet::~LslidarC16DriverNodelet() {
     NODELET_INFO("shutting down driver thread");
     running = false;
     device_thread->join();
+    if (publish_thread)
+      publish_thread->join();
     NODELET_INFO("driver thread stopped");
   }
   return;
@@ -53,10 +62,43 @@ void LslidarC16DriverNodelet::onInit()
     return;
   }
 
+  ros::NodeHandle& pnh = getPrivateNodeHandle();
+  int ring_size;
+  pnh.param<bool>("two_stage", two_stage, false);
+  pnh.param<int>("ring_size", ring_size, 1024);
+  pnh.param<int>("receive_cpu", receive_cpu, -1);
+
   // spawn device poll thread
   running = true;
-  device_thread = boost::shared_ptr< boost::thread >
-    (new boost::thread(boost::bind(&LslidarC16DriverNodelet::devicePoll, this)));
+  if (!two_stage) {
+    device_thread = boost::shared_ptr< boost::thread >
+      (new boost::thread(boost::bind(&LslidarC16DriverNodelet::devicePoll, this)));
+  } else {
+    packet_ring.reset(new PacketRing(ring_size));
+    ring_depth = &lslidar_c16_driver->getStatistics().addHistogram(
+        "ring depth", "packets");
+    lslidar_c16_driver->addDiagnosticTask("packet ring", boost::bind(
+        &LslidarC16DriverNodelet::ringDiagnostics, this, _1));
+    NODELET_INFO("two stage mode, ring size %lu", packet_ring->capacity());
+
+    publish_thread = boost::shared_ptr< boost::thread >
+      (new boost::thread(boost::bind(&LslidarC16DriverNodelet::publishPoll, this)));
+    device_thread = boost::shared_ptr< boost::thread >
+      (new boost::thread(boost::bind(&LslidarC16DriverNodelet::receivePoll, this)));
+  }
+
+  if (receive_cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(receive_cpu, &cpus);
+    int rc = pthread_setaffinity_np(device_thread->native_handle(),
+                                    sizeof(cpus), &cpus);
+    if (rc != 0)
+      NODELET_WARN("cannot pin receive thread to cpu %d: %s",
+                   receive_cpu, strerror(rc));
+    else
+      NODELET_INFO("receive thread pinned to cpu %d", receive_cpu);
+  }
 }
 
 /** @brief Device poll thread main loop. */
@@ -72,6 +114,61 @@ void LslidarC16DriverNodelet::devicePoll()
   running = false;
 }
 
+/** @brief Receive thread of the two-stage mode.
+ *
+ *  Only reads the socket and timestamps packets, so that a slow
+ *  publish or diagnostics update cannot back up the socket.
+ */
+void LslidarC16DriverNodelet::receivePoll()
+{
+  while(ros::ok() && running) {
+    lslidar_c16_msgs::LslidarC16PacketPtr packet =
+        lslidar_c16_driver->allocatePacket();
+    if (!lslidar_c16_driver->receivePacket(packet))
+      break;
+
+    ring_depth->add(packet_ring->size());
+    if (!packet_ring->push(packet)) {
+      uint64_t overruns = ++ring_overruns;
+      NODELET_WARN_THROTTLE(1.0, "packet ring full, %lu packets dropped",
+                            overruns);
+    }
+  }
+  running = false;
+}
+
+/** @brief Publish thread of the two-stage mode. */
+void LslidarC16DriverNodelet::publishPoll()
+{
+  lslidar_c16_msgs::LslidarC16PacketPtr packet;
+  int idle = 0;
+  while(ros::ok() && (running || packet_ring->size() > 0)) {
+    if (packet_ring->pop(packet)) {
+      lslidar_c16_driver->publishPacket(packet);
+      packet.reset();
+      idle = 0;
+    } else if (++idle < 64) {
+      // packets arrive about every 1.2ms, spin briefly before sleeping
+      sched_yield();
+    } else {
+      usleep(100);
+    }
+  }
+}
+
+void LslidarC16DriverNodelet::ringDiagnostics(
+    diagnostic_updater::DiagnosticStatusWrapper& stat)
+{
+  uint64_t overruns = ring_overruns;
+  if (overruns == 0)
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "no ring overruns");
+  else
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN, "packets dropped by ring overruns");
+  stat.add("ring overruns", overruns);
+  stat.add("ring depth", packet_ring->size());
+  stat.add("ring capacity", packet_ring->capacity());
+}
+
 } // namespace lslidar_driver
 
 // Register this plugin with pluginlib.  Names must match nodelet_lslidar.xml.
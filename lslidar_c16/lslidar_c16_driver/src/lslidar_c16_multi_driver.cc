@@ -0,0 +1,114 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+#include <lslidar_c16_driver/lslidar_c16_multi_driver.h>
+
+namespace lslidar_c16_driver {
+
+LslidarC16MultiDriver::LslidarC16MultiDriver(
+        ros::NodeHandle& n, ros::NodeHandle& pn):
+    nh(n),
+    pnh(pn),
+    epoll_id(-1) {
+    return;
+}
+
+LslidarC16MultiDriver::~LslidarC16MultiDriver() {
+    if (epoll_id != -1)
+        (void) close(epoll_id);
+    return;
+}
+
+bool LslidarC16MultiDriver::initialize() {
+
+    if (!pnh.getParam("lidars", lidar_names) || lidar_names.empty()) {
+        ROS_ERROR("Parameter ~lidars must list at least one lidar name");
+        return false;
+    }
+
+    epoll_id = epoll_create1(0);
+    if (epoll_id == -1) {
+        perror("epoll_create1");
+        return false;
+    }
+
+    for (size_t i = 0; i < lidar_names.size(); ++i) {
+        ros::NodeHandle lidar_nh(nh, lidar_names[i]);
+        ros::NodeHandle lidar_pnh(pnh, lidar_names[i]);
+
+        ROS_INFO_STREAM("Initialising lidar " << lidar_names[i]);
+        LslidarC16DriverPtr driver(new LslidarC16Driver(lidar_nh, lidar_pnh));
+        if (!driver->initialize()) {
+            ROS_ERROR_STREAM("Cannot initialize lidar " << lidar_names[i]);
+            return false;
+        }
+
+        if (driver->getSocket() == -1) {
+            ROS_ERROR_STREAM("Lidar " << lidar_names[i]
+                             << " has no socket, input_file is not supported here");
+            return false;
+        }
+
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        if (epoll_ctl(epoll_id, EPOLL_CTL_ADD, driver->getSocket(), &event) == -1) {
+            perror("epoll_ctl");
+            return false;
+        }
+        drivers.push_back(driver);
+    }
+
+    ROS_INFO("Serving %lu lidars from one epoll loop", drivers.size());
+    return true;
+}
+
+bool LslidarC16MultiDriver::polling() {
+    static const int POLL_TIMEOUT = 2000; // msec
+    static const int MAX_EVENTS = 16;
+
+    epoll_event events[MAX_EVENTS];
+    int nevents = epoll_wait(epoll_id, events, MAX_EVENTS, POLL_TIMEOUT);
+    if (nevents < 0) {
+        if (errno == EINTR)
+            return true;
+        ROS_ERROR("epoll_wait() error: %s", strerror(errno));
+        return false;
+    }
+    if (nevents == 0) {
+        ROS_WARN("lslidar epoll_wait() timeout");
+        return true;
+    }
+
+    for (int i = 0; i < nevents; ++i) {
+        const uint32_t idx = events[i].data.u32;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            ROS_ERROR_STREAM("epoll reports error on lidar " << lidar_names[idx]);
+            continue;
+        }
+        drivers[idx]->drainSocket();
+    }
+    return true;
+}
+
+} // namespace lslidar_c16_driver
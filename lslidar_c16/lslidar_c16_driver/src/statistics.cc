@@ -0,0 +1,172 @@
+/*
+ * This file is part of lslidar_c16 driver.
+ *
+ * The driver is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * The driver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the driver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <lslidar_c16_driver/statistics.h>
+
+namespace lslidar_c16_driver {
+
+double Histogram::bucketLow(int b) {
+    if (b < 4)
+        return b;
+    const int octave = (b - 4)/4 + 2;
+    return static_cast<double>(static_cast<uint64_t>(4 + (b - 4)%4) << (octave - 2));
+}
+
+double Histogram::Snapshot::percentile(double q) const {
+    if (count == 0)
+        return 0.0;
+
+    // Interpolate within the bucket holding the q-th value.
+    const double target = q * count < 1.0 ? 1.0 : q * count;
+    double before = 0.0;
+    for (int b = 0; b < BUCKETS; ++b) {
+        if (buckets[b] == 0)
+            continue;
+        if (before + buckets[b] >= target) {
+            // The buckets below 8 hold a single value each.
+            const double low = bucketLow(b);
+            if (b < 8)
+                return low;
+            const double high = b + 1 < BUCKETS ? bucketLow(b + 1) : low * 1.25;
+            return low + (high - low) * (target - before) / buckets[b];
+        }
+        before += buckets[b];
+    }
+    return bucketLow(BUCKETS - 1);
+}
+
+Histogram::Snapshot Histogram::Snapshot::operator-(const Snapshot& earlier) const {
+    Snapshot interval;
+    interval.count = count - earlier.count;
+    interval.sum = sum - earlier.sum;
+    for (int b = 0; b < BUCKETS; ++b)
+        interval.buckets[b] = buckets[b] - earlier.buckets[b];
+    return interval;
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    // The fields are read one by one, so take the count from the
+    // buckets to keep the snapshot consistent with itself.
+    Snapshot snap;
+    snap.count = 0;
+    snap.sum = sum.load(std::memory_order_relaxed);
+    for (int b = 0; b < BUCKETS; ++b) {
+        snap.buckets[b] = buckets[b].load(std::memory_order_relaxed);
+        snap.count += snap.buckets[b];
+    }
+    return snap;
+}
+
+Counter& Statistics::addCounter(const std::string& name) {
+    boost::mutex::scoped_lock lock(mutex);
+    counter_names.push_back(name);
+    counters.push_back(boost::shared_ptr<Counter>(new Counter(0)));
+    return *counters.back();
+}
+
+Histogram& Statistics::addHistogram(const std::string& name, const std::string& unit) {
+    boost::mutex::scoped_lock lock(mutex);
+    histogram_names.push_back(name);
+    histogram_units.push_back(unit);
+    histograms.push_back(boost::shared_ptr<Histogram>(new Histogram()));
+    return *histograms.back();
+}
+
+void Statistics::snapshot(Snapshot& last, Snapshot& interval) const {
+    interval.counters.resize(counters.size());
+    for (size_t i = 0; i < counters.size(); ++i)
+        interval.counters[i] = counters[i]->load(std::memory_order_relaxed);
+    last.counters = interval.counters;
+
+    // Histograms registered since the last report start from zero.
+    Histogram::Snapshot zero;
+    zero.count = 0;
+    zero.sum = 0;
+    for (int b = 0; b < Histogram::BUCKETS; ++b)
+        zero.buckets[b] = 0;
+    last.histograms.resize(histograms.size(), zero);
+    interval.histograms.resize(histograms.size());
+    for (size_t i = 0; i < histograms.size(); ++i) {
+        const Histogram::Snapshot now = histograms[i]->snapshot();
+        interval.histograms[i] = now - last.histograms[i];
+        last.histograms[i] = now;
+    }
+}
+
+void Statistics::report(Snapshot& last,
+                        diagnostic_updater::DiagnosticStatusWrapper& stat) const {
+    boost::mutex::scoped_lock lock(mutex);
+    Snapshot interval;
+    snapshot(last, interval);
+
+    for (size_t i = 0; i < counter_names.size(); ++i)
+        stat.add(counter_names[i], interval.counters[i]);
+    for (size_t i = 0; i < histogram_names.size(); ++i) {
+        const Histogram::Snapshot& h = interval.histograms[i];
+        const char* unit = histogram_units[i].c_str();
+        stat.addf(histogram_names[i],
+                  "n %lu, mean %.1f %s, p50 %.1f %s, p99 %.1f %s, max %.1f %s",
+                  (unsigned long)h.count, h.mean(), unit,
+                  h.percentile(0.5), unit, h.percentile(0.99), unit, h.max(), unit);
+    }
+}
+
+void Statistics::report(Snapshot& last,
+                        lslidar_c16_msgs::LslidarC16Statistics& msg) const {
+    boost::mutex::scoped_lock lock(mutex);
+    Snapshot interval;
+    snapshot(last, interval);
+
+    msg.counter_names = counter_names;
+    msg.counter_values = interval.counters;
+    msg.histograms.resize(histogram_names.size());
+    for (size_t i = 0; i < histogram_names.size(); ++i) {
+        const Histogram::Snapshot& h = interval.histograms[i];
+        lslidar_c16_msgs::LslidarC16Histogram& out = msg.histograms[i];
+        out.name = histogram_names[i];
+        out.unit = histogram_units[i];
+        out.count = h.count;
+        out.mean = h.mean();
+        out.p50 = h.percentile(0.5);
+        out.p90 = h.percentile(0.9);
+        out.p99 = h.percentile(0.99);
+        out.max = h.max();
+    }
+}
+
+void StatisticsPublisher::start(const Statistics& stats, ros::NodeHandle& nh,
+                                const std::string& topic, const std::string& name,
+                                double period) {
+    if (period <= 0.0)
+        return;
+    statistics = &stats;
+    source = name;
+    pub = nh.advertise<lslidar_c16_msgs::LslidarC16Statistics>(topic, 10);
+    timer = nh.createWallTimer(ros::WallDuration(period),
+                               &StatisticsPublisher::publish, this);
+}
+
+void StatisticsPublisher::publish(const ros::WallTimerEvent& event) {
+    lslidar_c16_msgs::LslidarC16StatisticsPtr msg(
+                new lslidar_c16_msgs::LslidarC16Statistics());
+    msg->header.stamp = ros::Time::now();
+    msg->source = source;
+    statistics->report(last, *msg);
+    pub.publish(msg);
+}
+
+} // namespace lslidar_c16_driver